@@ -0,0 +1,286 @@
+/*
+本文件是 libelas 的一部分。
+
+libelas 是自由软件；你可以根据自由软件基金会发布的 GNU 通用公共许可证
+（GNU General Public License）第 3 版，或（由你选择的）任何更高版本的条款
+对其进行再发布和/或修改。
+
+发布 libelas 的目的是希望它能发挥作用，但**不提供任何担保**；甚至不包含
+对适销性或特定用途适用性的默示担保。更多细节请参阅 GNU 通用公共许可证。
+
+你应该已经随同 libelas 一起收到了 GNU 通用公共许可证的副本；
+如果没有，请写信至 Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA。
+*/
+
+#include "delaunay.h"
+
+using namespace std;
+
+// 约定：三角形 (a,b,c) 满足 orient(a,b,c)>0；半边 e 从 tri[e] 指向 tri[nextHalfedge(e)]，
+// 三角形内部位于半边左侧。
+
+inline int64_t Delaunay::orient (int32_t a,int32_t b,int32_t c) const {
+  int64_t ax = coords[2*a], ay = coords[2*a+1];
+  int64_t bx = coords[2*b], by = coords[2*b+1];
+  int64_t cx = coords[2*c], cy = coords[2*c+1];
+  return (bx-ax)*(cy-ay)-(by-ay)*(cx-ax);
+}
+
+// 若 d 严格位于三角形 (a,b,c)（orient>0）的外接圆内部则返回 true
+inline bool Delaunay::inCircle (int32_t a,int32_t b,int32_t c,int32_t d) const {
+  int64_t dx  = coords[2*d], dy = coords[2*d+1];
+  int64_t adx = coords[2*a]-dx, ady = coords[2*a+1]-dy;
+  int64_t bdx = coords[2*b]-dx, bdy = coords[2*b+1]-dy;
+  int64_t cdx = coords[2*c]-dx, cdy = coords[2*c+1]-dy;
+  int64_t ap  = adx*adx+ady*ady;
+  int64_t bp  = bdx*bdx+bdy*bdy;
+  int64_t cp  = cdx*cdx+cdy*cdy;
+  return adx*(bdy*cp-bp*cdy)-ady*(bdx*cp-bp*cdx)+ap*(bdx*cdy-bdy*cdx) > 0;
+}
+
+inline void Delaunay::link (int32_t a,int32_t b) {
+  halfedges[a] = b;
+  if (b>=0) halfedges[b] = a;
+}
+
+// 与左右边界边相连：code>=0 为已有半边，code<=-2 表示退化带状区域 -code-2 的线段边
+inline void Delaunay::linkBoundary (int32_t a,int32_t code) {
+  if (code>=0) {
+    link(a,code);
+  } else if (code<=-2) {
+    int32_t &pinch = pinch_edge[-code-2];
+    if (pinch<0) pinch = a;
+    else         link(a,pinch);
+  }
+}
+
+int32_t Delaunay::addTriangle (int32_t a,int32_t b,int32_t c,int32_t ha,int32_t hb,int32_t hc) {
+  int32_t t = tri->size();
+  tri->push_back(a);
+  tri->push_back(b);
+  tri->push_back(c);
+  halfedges.push_back(-1);
+  halfedges.push_back(-1);
+  halfedges.push_back(-1);
+  link(t+0,ha);
+  link(t+1,hb);
+  link(t+2,hc);
+  return t;
+}
+
+void Delaunay::sortPoints (int32_t num_points) {
+  
+  // 坐标范围
+  int32_t u_min = coords[0], u_max = coords[0];
+  int32_t v_min = coords[1], v_max = coords[1];
+  for (int32_t i=1; i<num_points; i++) {
+    u_min = min(u_min,coords[2*i]);   u_max = max(u_max,coords[2*i]);
+    v_min = min(v_min,coords[2*i+1]); v_max = max(v_max,coords[2*i+1]);
+  }
+  
+  order.resize(num_points);
+  order_tmp.resize(num_points);
+  
+  // 第一趟：按 u 计数排序
+  histogram.assign(u_max-u_min+2,0);
+  for (int32_t i=0; i<num_points; i++)
+    histogram[coords[2*i]-u_min+1]++;
+  for (size_t i=1; i<histogram.size(); i++)
+    histogram[i] += histogram[i-1];
+  for (int32_t i=0; i<num_points; i++)
+    order_tmp[histogram[coords[2*i]-u_min]++] = i;
+  
+  // 第二趟：按 v 稳定计数排序，得到 (v,u) 字典序
+  histogram.assign(v_max-v_min+2,0);
+  for (int32_t i=0; i<num_points; i++)
+    histogram[coords[2*i+1]-v_min+1]++;
+  for (size_t i=1; i<histogram.size(); i++)
+    histogram[i] += histogram[i-1];
+  for (int32_t i=0; i<num_points; i++) {
+    int32_t k = order_tmp[i];
+    order[histogram[coords[2*k+1]-v_min]++] = k;
+  }
+}
+
+// 三角剖分第 r 行与第 r+1 行之间的带状区域：两行点分别位于两条水平线上，
+// 任意"拉链"式连接都是有效的三角剖分，每一步选择局部满足 Delaunay 性质的对角线
+void Delaunay::triangulateStrip (int32_t r) {
+  
+  int32_t i     = row_begin[r],   i_end = row_begin[r+1]-1;  // 下方行 A
+  int32_t j     = row_begin[r+1], j_end = row_begin[r+2]-1;  // 上方行 B
+  int32_t right = -1;
+  
+  left_edge[r]  = -1;
+  
+  while (i<i_end || j<j_end) {
+    int32_t a0 = order[i], b0 = order[j];
+    int32_t t,left_rung,right_rung;
+    if (j==j_end || (i<i_end && !inCircle(a0,order[i+1],b0,order[j+1]))) {
+      t = addTriangle(a0,order[i+1],b0,row_edge[i],-1,-1);  // A_i -> A_i+1 -> B_j
+      left_rung  = t+2;
+      right_rung = t+1;
+      i++;
+    } else {
+      t = addTriangle(a0,order[j+1],b0,-1,-1,-1);           // A_i -> B_j+1 -> B_j
+      row_edge[j] = t+1;
+      left_rung  = t+2;
+      right_rung = t+0;
+      j++;
+    }
+    if (right<0) left_edge[r] = left_rung;
+    else         link(left_rung,right);
+    right = right_rung;
+  }
+  right_edge[r] = right;
+}
+
+// 左边界（各行首点自下而上）上的凹处补三角形
+void Delaunay::fillLeftPockets () {
+  
+  chain_vertex.clear();
+  chain_edge.clear();
+  chain_vertex.push_back(order[row_begin[0]]);
+  chain_edge.push_back(-1);
+  
+  for (int32_t r=1; r<num_rows; r++) {
+    int32_t v = order[row_begin[r]];
+    int32_t e = left_edge[r-1]>=0 ? left_edge[r-1] : -(r-1)-2;  // v -> 前一行首点
+    while (chain_vertex.size()>=2) {
+      int32_t s0 = chain_vertex[chain_vertex.size()-2];
+      int32_t s1 = chain_vertex.back();
+      if (orient(s0,s1,v)<=0)
+        break;
+      int32_t t = addTriangle(s0,s1,v,-1,-1,-1);
+      linkBoundary(t+0,chain_edge.back());
+      linkBoundary(t+1,e);
+      e = t+2;
+      chain_vertex.pop_back();
+      chain_edge.pop_back();
+    }
+    chain_vertex.push_back(v);
+    chain_edge.push_back(e);
+  }
+}
+
+// 右边界（各行末点自下而上）上的凹处补三角形
+void Delaunay::fillRightPockets () {
+  
+  chain_vertex.clear();
+  chain_edge.clear();
+  chain_vertex.push_back(order[row_begin[1]-1]);
+  chain_edge.push_back(-1);
+  
+  for (int32_t r=1; r<num_rows; r++) {
+    int32_t v = order[row_begin[r+1]-1];
+    int32_t e = right_edge[r-1]>=0 ? right_edge[r-1] : -(r-1)-2;  // 前一行末点 -> v
+    while (chain_vertex.size()>=2) {
+      int32_t s0 = chain_vertex[chain_vertex.size()-2];
+      int32_t s1 = chain_vertex.back();
+      if (orient(s1,s0,v)<=0)
+        break;
+      int32_t t = addTriangle(s1,s0,v,-1,-1,-1);
+      linkBoundary(t+0,chain_edge.back());
+      linkBoundary(t+2,e);
+      e = t+1;
+      chain_vertex.pop_back();
+      chain_edge.pop_back();
+    }
+    chain_vertex.push_back(v);
+    chain_edge.push_back(e);
+  }
+}
+
+// Lawson 翻边：edge_stack 中为待检查的半边
+void Delaunay::legalize () {
+  
+  while (!edge_stack.empty()) {
+    int32_t a = edge_stack.back();
+    edge_stack.pop_back();
+    
+    // 凸包边无需翻转
+    int32_t b = halfedges[a];
+    if (b<0)
+      continue;
+    
+    // 三角形 a = (pr,pl,p0) 与 b = (pl,pr,p1) 共享边 pr-pl；
+    // 翻边后变为 (p1,pl,p0) 与 (p0,pr,p1)，共享边 p0-p1
+    int32_t al = nextHalfedge(a);
+    int32_t ar = prevHalfedge(a);
+    int32_t br = nextHalfedge(b);
+    int32_t bl = prevHalfedge(b);
+    int32_t pr = (*tri)[a];
+    int32_t pl = (*tri)[al];
+    int32_t p0 = (*tri)[ar];
+    int32_t p1 = (*tri)[bl];
+    
+    // 对边顶点严格位于外接圆内时才翻转（共圆时保持不变，保证终止）
+    if (!inCircle(pr,pl,p0,p1))
+      continue;
+    
+    (*tri)[a] = p1;
+    (*tri)[b] = p0;
+    link(a,halfedges[bl]);
+    link(b,halfedges[ar]);
+    link(ar,bl);
+    
+    // 四条外侧边可能因此不再满足 Delaunay 性质
+    edge_stack.push_back(a);
+    edge_stack.push_back(al);
+    edge_stack.push_back(b);
+    edge_stack.push_back(br);
+  }
+}
+
+void Delaunay::triangulate (const int32_t* points,int32_t num_points,vector<int32_t> &triangles) {
+  
+  coords = points;
+  tri    = &triangles;
+  tri->clear();
+  halfedges.clear();
+  if (num_points<3)
+    return;
+  
+  // 三角形数不超过 2n，预留空间后剖分过程中不再重新分配
+  tri->reserve(6*num_points);
+  halfedges.reserve(6*num_points);
+  
+  // 按 (v,u) 字典序排序，去除重复点并划分行
+  sortPoints(num_points);
+  int32_t num_unique = 0;
+  row_begin.clear();
+  for (int32_t i=0; i<num_points; i++) {
+    int32_t k = order[i];
+    if (num_unique>0) {
+      int32_t l = order[num_unique-1];
+      if (coords[2*k+1]==coords[2*l+1] && coords[2*k]==coords[2*l])
+        continue;
+    }
+    if (num_unique==0 || coords[2*k+1]!=coords[2*order[num_unique-1]+1])
+      row_begin.push_back(num_unique);
+    order[num_unique++] = k;
+  }
+  num_rows = row_begin.size();
+  row_begin.push_back(num_unique);
+  if (num_rows<2)
+    return;
+  
+  // 逐个带状区域连接相邻两行
+  row_edge.assign(num_unique,-1);
+  left_edge.resize(num_rows);
+  right_edge.resize(num_rows);
+  pinch_edge.assign(num_rows,-1);
+  for (int32_t r=0; r+1<num_rows; r++)
+    triangulateStrip(r);
+  
+  // 补齐为凸包
+  fillLeftPockets();
+  fillRightPockets();
+  
+  // 对全部内部边执行 Lawson 翻边，得到 Delaunay 三角剖分
+  edge_stack.clear();
+  for (int32_t e=0; e<(int32_t)halfedges.size(); e++)
+    if (halfedges[e]>e)
+      edge_stack.push_back(e);
+  legalize();
+}
@@ -0,0 +1,93 @@
+/*
+本文件是 libelas 的一部分。
+
+libelas 是自由软件；你可以根据自由软件基金会发布的 GNU 通用公共许可证
+（GNU General Public License）第 3 版，或（由你选择的）任何更高版本的条款
+对其进行再发布和/或修改。
+
+发布 libelas 的目的是希望它能发挥作用，但**不提供任何担保**；甚至不包含
+对适销性或特定用途适用性的默示担保。更多细节请参阅 GNU 通用公共许可证。
+
+你应该已经随同 libelas 一起收到了 GNU 通用公共许可证的副本；
+如果没有，请写信至 Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA。
+*/
+
+// 说明：针对 ELAS 支持点的快速 Delaunay 三角剖分，可替代通用的 Triangle 库。
+//
+// 支持点位于 candidate_stepsize 规则网格的若干行上（右图中的点只是在行内
+// 平移了 u-d），坐标均为不大的整数。因此：
+//   - 用两趟计数排序即可按 (v,u) 字典序排列全部点（线性时间）；
+//   - 相邻两行之间的带状区域直接按"拉链"方式连成三角形，再把各行首、行尾
+//     构成的左右边界凹处补齐为凸包，得到一个有效的初始三角剖分；
+//   - 该初始剖分已接近 Delaunay，最后用 Lawson 翻边修正少量非 Delaunay 边；
+//   - 所有几何判定都用 64 位整数精确计算，不需要自适应精度谓词。
+// 所有缓冲区都在多次调用之间复用，稳态下不再分配内存。
+
+#ifndef __DELAUNAY_H__
+#define __DELAUNAY_H__
+
+#include <vector>
+#include <stdint.h>
+
+class Delaunay {
+
+public:
+
+  Delaunay () : coords(0),tri(0) {}
+
+  // 三角剖分
+  // 输入：points     = 整数点坐标 (u0,v0,u1,v1,...)，共 num_points 个点
+  // 输出：triangles  = 三角形顶点索引 (c1,c2,c3,...)，索引对应输入点的顺序；
+  //                    重复的点只有一个会出现在三角形中（与 Triangle 库一致），
+  //                    所有点共线时输出为空
+  void triangulate (const int32_t* points,int32_t num_points,std::vector<int32_t> &triangles);
+
+private:
+
+  // 半边 e 所在三角形中的下一条 / 上一条半边
+  static inline int32_t nextHalfedge (int32_t e) { return (e%3==2) ? e-2 : e+1; }
+  static inline int32_t prevHalfedge (int32_t e) { return (e%3==0) ? e+2 : e-1; }
+
+  // 精确几何判定
+  inline int64_t orient (int32_t a,int32_t b,int32_t c) const;
+  inline bool    inCircle (int32_t a,int32_t b,int32_t c,int32_t d) const;
+
+  void sortPoints (int32_t num_points);
+  int32_t addTriangle (int32_t a,int32_t b,int32_t c,int32_t ha,int32_t hb,int32_t hc);
+  inline void link (int32_t a,int32_t b);
+  inline void linkBoundary (int32_t a,int32_t code);
+  void triangulateStrip (int32_t r);
+  void fillLeftPockets ();
+  void fillRightPockets ();
+  void legalize ();
+
+  // 输入点坐标
+  const int32_t *coords;
+
+  // 输出：三角形顶点与相对半边（-1 表示凸包边）
+  std::vector<int32_t> *tri;
+  std::vector<int32_t>  halfedges;
+
+  // 排序结果及计数排序的辅助缓冲区
+  std::vector<int32_t> order,order_tmp,histogram;
+
+  // 每行在 order 中的起始位置（共 num_rows+1 项）
+  std::vector<int32_t> row_begin;
+  int32_t              num_rows;
+
+  // row_edge[i]：order[i] 与 order[i+1] 之间的行内边在下方带状区域中的半边
+  std::vector<int32_t> row_edge;
+
+  // 每个带状区域左右两侧的边界半边；两行都只有一个点的带状区域退化为线段，
+  // 其两侧由补凸包时生成的三角形通过 pinch_edge 相连
+  std::vector<int32_t> left_edge,right_edge,pinch_edge;
+
+  // 补凸包时使用的栈（顶点及其与前一个栈顶点之间的边界半边）
+  std::vector<int32_t> chain_vertex,chain_edge;
+
+  // 翻边使用的栈
+  std::vector<int32_t> edge_stack;
+};
+
+#endif
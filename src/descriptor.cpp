@@ -19,95 +19,243 @@ libelas 是自由软件；你可以根据自由软件基金会发布的 GNU 通
 */
 
 #include "descriptor.h"
-#include "filter.h"
+#include <algorithm>
 #include <emmintrin.h>
 
 using namespace std;
 
-Descriptor::Descriptor(uint8_t* I,int32_t width,int32_t height,int32_t bpl,bool half_resolution) {
-  I_desc        = (uint8_t*)_mm_malloc(16*width*height*sizeof(uint8_t),16);
-  uint8_t* I_du = (uint8_t*)_mm_malloc(bpl*height*sizeof(uint8_t),16);
-  uint8_t* I_dv = (uint8_t*)_mm_malloc(bpl*height*sizeof(uint8_t),16);
-  filter::sobel3x3(I,I_du,I_dv,bpl,height);
-  createDescriptor(I_du,I_dv,width,height,bpl,half_resolution);
-  _mm_free(I_du);
-  _mm_free(I_dv);
+namespace {
+
+  // 16x16 字节矩阵转置：x[k] 的第 j 个字节移动到 x[j] 的第 k 个字节。
+  // 每一轮把 (行,列) 的 8 位下标循环左移一位，四轮后行列互换。
+  inline void transpose16x16 (__m128i* x) {
+    __m128i y[16];
+    for (int32_t pass=0; pass<4; pass++) {
+      for (int32_t i=0; i<8; i++) {
+        y[2*i+0] = _mm_unpacklo_epi8(x[i],x[i+8]);
+        y[2*i+1] = _mm_unpackhi_epi8(x[i],x[i+8]);
+      }
+      for (int32_t i=0; i<16; i++)
+        x[i] = y[i];
+    }
+  }
+
+}
+
+Descriptor::Descriptor() :
+  I_desc(0),width(0),height(0),bpl(0),half_resolution(false),size(16),row_begin(0),stored_rows(0),du_rows(0),dv_rows(0),col_v(0),col_h(0) {}
+
+Descriptor::Descriptor(uint8_t* I,int32_t width,int32_t height,int32_t bpl,bool half_resolution,int32_t size) :
+  I_desc(0),width(0),height(0),bpl(0),half_resolution(false),size(16),row_begin(0),stored_rows(0),du_rows(0),dv_rows(0),col_v(0),col_h(0) {
+  compute(I,width,height,bpl,half_resolution,size);
 }
 
 Descriptor::~Descriptor() {
-  _mm_free(I_desc);
+  release();
 }
 
-void Descriptor::createDescriptor (uint8_t* I_du,uint8_t* I_dv,int32_t width,int32_t height,int32_t bpl,bool half_resolution) {
+void Descriptor::release() {
+  _mm_free(I_desc);
+  _mm_free(du_rows);
+  _mm_free(dv_rows);
+  _mm_free(col_v);
+  _mm_free(col_h);
+  I_desc = 0; du_rows = 0; dv_rows = 0; col_v = 0; col_h = 0;
+  width = height = bpl = 0;
+  half_resolution = false;
+  size = 16;
+  stored_rows = 0;
+}
 
-  uint8_t *I_desc_curr;  
-  uint32_t addr_v0,addr_v1,addr_v2,addr_v3,addr_v4;
+void Descriptor::reserve(int32_t width_,int32_t height_,int32_t bpl_,bool half_resolution_,int32_t size_,int32_t band_rows) {
+  int32_t rows = band_rows>0 ? min(band_rows,height_) : height_;
+  if (half_resolution_)
+    rows = (rows+1)/2;
+  if (I_desc && width==width_ && height==height_ && bpl==bpl_ && half_resolution==half_resolution_ && size==size_ && stored_rows==rows)
+    return;
+  release();
+  width   = width_;
+  height  = height_;
+  bpl     = bpl_;
+  half_resolution = half_resolution_;
+  size    = size_;
+  stored_rows = rows;
+  I_desc  = (uint8_t*)_mm_malloc(size*width*rows*sizeof(uint8_t),16);
+  du_rows = (uint8_t*)_mm_malloc(5*bpl*sizeof(uint8_t),16);
+  dv_rows = (uint8_t*)_mm_malloc(5*bpl*sizeof(uint8_t),16);
+  col_v   = (int16_t*)_mm_malloc((bpl+16)*sizeof(int16_t),16);
+  col_h   = (int16_t*)_mm_malloc((bpl+16)*sizeof(int16_t),16);
   
-  // 在 half_resolution 模式下：只在隔行位置计算描述子
-  if (half_resolution) {
+  // 边界行/列不会被写入，清零后其内容在多帧之间保持确定；
+  // 列滤波结果前后各留 8 个元素的零填充，使行滤波在首尾也可以整块读取
+  memset(I_desc,0,size*width*rows*sizeof(uint8_t));
+  memset(du_rows,0,5*bpl*sizeof(uint8_t));
+  memset(dv_rows,0,5*bpl*sizeof(uint8_t));
+  memset(col_v,0,(bpl+16)*sizeof(int16_t));
+  memset(col_h,0,(bpl+16)*sizeof(int16_t));
+}
+
+void Descriptor::compute(const uint8_t* I,int32_t width,int32_t height,int32_t bpl,bool half_resolution,int32_t size) {
+  reserve(width,height,bpl,half_resolution,size);
+  computeRows(I,0,height);
+}
+
+void Descriptor::computeRows(const uint8_t* I,int32_t v_begin,int32_t v_end) {
+  row_begin = v_begin;
   
-    // 创建用于滤波的条带
-    for (int32_t v=4; v<height-3; v+=2) {
-
-      addr_v2 = v*bpl;
-      addr_v0 = addr_v2-2*bpl;
-      addr_v1 = addr_v2-1*bpl;
-      addr_v3 = addr_v2+1*bpl;
-      addr_v4 = addr_v2+2*bpl;
-
-      for (int32_t u=3; u<width-3; u++) {
-        I_desc_curr = I_desc+(v*width+u)*16;
-        *(I_desc_curr++) = *(I_du+addr_v0+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v1+u-2);
-        *(I_desc_curr++) = *(I_du+addr_v1+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v1+u+2);
-        *(I_desc_curr++) = *(I_du+addr_v2+u-1);
-        *(I_desc_curr++) = *(I_du+addr_v2+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v2+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v2+u+1);
-        *(I_desc_curr++) = *(I_du+addr_v3+u-2);
-        *(I_desc_curr++) = *(I_du+addr_v3+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v3+u+2);
-        *(I_desc_curr++) = *(I_du+addr_v4+u+0);
-        *(I_desc_curr++) = *(I_dv+addr_v1+u+0);
-        *(I_desc_curr++) = *(I_dv+addr_v2+u-1);
-        *(I_desc_curr++) = *(I_dv+addr_v2+u+1);
-        *(I_desc_curr++) = *(I_dv+addr_v3+u+0);
-      }
+  // 条带中没有描述子的边界行清零（整幅图像模式下这些行从未写入，本来就是零）
+  int32_t v_first = half_resolution ? 4 : 3;
+  int32_t v_step  = half_resolution ? 2 : 1;
+  for (int32_t v=v_begin; v<v_end; v+=v_step)
+    if (v<v_first || v>=height-3)
+      memset(I_desc+((v-row_begin)/v_step)*width*size,0,width*size*sizeof(uint8_t));
+
+  // 逐行流式处理：第 v 行描述子需要第 v-2 ... v+2 行的梯度，
+  // 梯度行只在首次用到时计算一次，并保存在 5 行的滚动窗口中
+  int32_t v_next = max(v_first,v_begin)-2;
+  for (int32_t v=max(v_first,v_begin); v<min(v_end,height-3); v+=v_step) {
+    for (; v_next<=v+2; v_next++)
+      computeGradientRow(I,v_next);
+    createDescriptorRow(v);
+  }
+}
+
+void Descriptor::computeGradientRow (const uint8_t* I,int32_t v) {
+
+  // 列方向：col_v = (1,2,1)^T 平滑，col_h = (1,0,-1)^T 差分（16 位）
+  const uint8_t* in0 = I+(v-1)*bpl;
+  const uint8_t* in1 = I+(v+0)*bpl;
+  const uint8_t* in2 = I+(v+1)*bpl;
+  int16_t* tv = col_v+8;
+  int16_t* th = col_h+8;
+  __m128i zero = _mm_setzero_si128();
+  for (int32_t u=0; u<bpl; u+=16) {
+    __m128i r0 = _mm_loadu_si128((__m128i*)(in0+u));
+    __m128i r1 = _mm_loadu_si128((__m128i*)(in1+u));
+    __m128i r2 = _mm_loadu_si128((__m128i*)(in2+u));
+    __m128i r0_lo = _mm_unpacklo_epi8(r0,zero), r0_hi = _mm_unpackhi_epi8(r0,zero);
+    __m128i r1_lo = _mm_unpacklo_epi8(r1,zero), r1_hi = _mm_unpackhi_epi8(r1,zero);
+    __m128i r2_lo = _mm_unpacklo_epi8(r2,zero), r2_hi = _mm_unpackhi_epi8(r2,zero);
+    _mm_store_si128((__m128i*)(tv+u+0),_mm_add_epi16(_mm_add_epi16(r0_lo,r2_lo),_mm_add_epi16(r1_lo,r1_lo)));
+    _mm_store_si128((__m128i*)(tv+u+8),_mm_add_epi16(_mm_add_epi16(r0_hi,r2_hi),_mm_add_epi16(r1_hi,r1_hi)));
+    _mm_store_si128((__m128i*)(th+u+0),_mm_sub_epi16(r0_lo,r2_lo));
+    _mm_store_si128((__m128i*)(th+u+8),_mm_sub_epi16(r0_hi,r2_hi));
+  }
+
+  // 行方向：du = (1,0,-1) * col_v，dv = (1,2,1) * col_h，
+  // 结果除以 4 后平移到 [0,255] 并饱和截断（与 filter::sobel3x3 一致）
+  uint8_t* du = du_rows+(v%5)*bpl;
+  uint8_t* dv = dv_rows+(v%5)*bpl;
+  __m128i offs = _mm_set1_epi16(128);
+  for (int32_t u=0; u<bpl; u+=16) {
+    __m128i res[2][2];
+    for (int32_t k=0; k<2; k++) {
+      int32_t uk = u+8*k;
+      __m128i v_m = _mm_loadu_si128((__m128i*)(tv+uk-1));
+      __m128i v_p = _mm_loadu_si128((__m128i*)(tv+uk+1));
+      __m128i h_m = _mm_loadu_si128((__m128i*)(th+uk-1));
+      __m128i h_0 = _mm_load_si128 ((__m128i*)(th+uk+0));
+      __m128i h_p = _mm_loadu_si128((__m128i*)(th+uk+1));
+      res[0][k] = _mm_add_epi16(_mm_srai_epi16(_mm_sub_epi16(v_m,v_p),2),offs);
+      res[1][k] = _mm_add_epi16(_mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(h_m,h_p),_mm_add_epi16(h_0,h_0)),2),offs);
     }
-    
-  // 否则：计算完整分辨率的描述子图像
-  } else {
-    
-    // 创建用于滤波的条带
-    for (int32_t v=3; v<height-3; v++) {
-
-      addr_v2 = v*bpl;
-      addr_v0 = addr_v2-2*bpl;
-      addr_v1 = addr_v2-1*bpl;
-      addr_v3 = addr_v2+1*bpl;
-      addr_v4 = addr_v2+2*bpl;
-
-      for (int32_t u=3; u<width-3; u++) {
-        I_desc_curr = I_desc+(v*width+u)*16;
-        *(I_desc_curr++) = *(I_du+addr_v0+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v1+u-2);
-        *(I_desc_curr++) = *(I_du+addr_v1+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v1+u+2);
-        *(I_desc_curr++) = *(I_du+addr_v2+u-1);
-        *(I_desc_curr++) = *(I_du+addr_v2+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v2+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v2+u+1);
-        *(I_desc_curr++) = *(I_du+addr_v3+u-2);
-        *(I_desc_curr++) = *(I_du+addr_v3+u+0);
-        *(I_desc_curr++) = *(I_du+addr_v3+u+2);
-        *(I_desc_curr++) = *(I_du+addr_v4+u+0);
-        *(I_desc_curr++) = *(I_dv+addr_v1+u+0);
-        *(I_desc_curr++) = *(I_dv+addr_v2+u-1);
-        *(I_desc_curr++) = *(I_dv+addr_v2+u+1);
-        *(I_desc_curr++) = *(I_dv+addr_v3+u+0);
-      }
+    _mm_store_si128((__m128i*)(du+u),_mm_packus_epi16(res[0][0],res[0][1]));
+    _mm_store_si128((__m128i*)(dv+u),_mm_packus_epi16(res[1][0],res[1][1]));
+  }
+}
+
+void Descriptor::createDescriptorRow (int32_t v) {
+
+  // 滚动窗口中第 v-2 ... v+2 行梯度的起始地址
+  const uint8_t* du0 = du_rows+((v-2)%5)*bpl;
+  const uint8_t* du1 = du_rows+((v-1)%5)*bpl;
+  const uint8_t* du2 = du_rows+((v+0)%5)*bpl;
+  const uint8_t* du3 = du_rows+((v+1)%5)*bpl;
+  const uint8_t* du4 = du_rows+((v+2)%5)*bpl;
+  const uint8_t* dv1 = dv_rows+((v-1)%5)*bpl;
+  const uint8_t* dv2 = dv_rows+((v+0)%5)*bpl;
+  const uint8_t* dv3 = dv_rows+((v+1)%5)*bpl;
+  uint8_t* I_desc_line = I_desc+(half_resolution ? (v-row_begin)/2 : v-row_begin)*width*size;
+
+  // 精简描述子：以 (u,v) 为中心的十字形上 5 个水平梯度与 3 个垂直梯度，
+  // 转置时后 8 个向量填零，每个像素只写出低 8 字节
+  if (size==8) {
+    int32_t u = 3;
+    for (; u+16<=width-3; u+=16) {
+      __m128i x[16];
+      x[0] = _mm_loadu_si128((__m128i*)(du0+u+0));
+      x[1] = _mm_loadu_si128((__m128i*)(du2+u-2));
+      x[2] = _mm_loadu_si128((__m128i*)(du2+u+0));
+      x[3] = _mm_loadu_si128((__m128i*)(du2+u+2));
+      x[4] = _mm_loadu_si128((__m128i*)(du4+u+0));
+      x[5] = _mm_loadu_si128((__m128i*)(dv1+u+0));
+      x[6] = _mm_loadu_si128((__m128i*)(dv2+u+0));
+      x[7] = _mm_loadu_si128((__m128i*)(dv3+u+0));
+      for (int32_t i=8; i<16; i++)
+        x[i] = _mm_setzero_si128();
+      transpose16x16(x);
+      uint8_t* I_desc_curr = I_desc_line+u*8;
+      for (int32_t i=0; i<16; i++)
+        _mm_storel_epi64((__m128i*)(I_desc_curr+8*i),x[i]);
     }
+    for (; u<width-3; u++) {
+      uint8_t* I_desc_curr = I_desc_line+u*8;
+      *(I_desc_curr++) = *(du0+u+0);
+      *(I_desc_curr++) = *(du2+u-2);
+      *(I_desc_curr++) = *(du2+u+0);
+      *(I_desc_curr++) = *(du2+u+2);
+      *(I_desc_curr++) = *(du4+u+0);
+      *(I_desc_curr++) = *(dv1+u+0);
+      *(I_desc_curr++) = *(dv2+u+0);
+      *(I_desc_curr++) = *(dv3+u+0);
+    }
+    return;
+  }
+
+  // 每次处理 16 个像素：第 k 个向量保存 16 个像素描述子的第 k 个字节，转置后逐像素写出
+  int32_t u = 3;
+  for (; u+16<=width-3; u+=16) {
+    __m128i x[16];
+    x[ 0] = _mm_loadu_si128((__m128i*)(du0+u+0));
+    x[ 1] = _mm_loadu_si128((__m128i*)(du1+u-2));
+    x[ 2] = _mm_loadu_si128((__m128i*)(du1+u+0));
+    x[ 3] = _mm_loadu_si128((__m128i*)(du1+u+2));
+    x[ 4] = _mm_loadu_si128((__m128i*)(du2+u-1));
+    x[ 5] = _mm_loadu_si128((__m128i*)(du2+u+0));
+    x[ 6] = x[5];
+    x[ 7] = _mm_loadu_si128((__m128i*)(du2+u+1));
+    x[ 8] = _mm_loadu_si128((__m128i*)(du3+u-2));
+    x[ 9] = _mm_loadu_si128((__m128i*)(du3+u+0));
+    x[10] = _mm_loadu_si128((__m128i*)(du3+u+2));
+    x[11] = _mm_loadu_si128((__m128i*)(du4+u+0));
+    x[12] = _mm_loadu_si128((__m128i*)(dv1+u+0));
+    x[13] = _mm_loadu_si128((__m128i*)(dv2+u-1));
+    x[14] = _mm_loadu_si128((__m128i*)(dv2+u+1));
+    x[15] = _mm_loadu_si128((__m128i*)(dv3+u+0));
+    transpose16x16(x);
+    __m128i* I_desc_curr = (__m128i*)(I_desc_line+u*16);
+    for (int32_t i=0; i<16; i++)
+      _mm_store_si128(I_desc_curr+i,x[i]);
+  }
+
+  // 行尾不足 16 个像素的部分逐字节写出
+  for (; u<width-3; u++) {
+    uint8_t* I_desc_curr = I_desc_line+u*16;
+    *(I_desc_curr++) = *(du0+u+0);
+    *(I_desc_curr++) = *(du1+u-2);
+    *(I_desc_curr++) = *(du1+u+0);
+    *(I_desc_curr++) = *(du1+u+2);
+    *(I_desc_curr++) = *(du2+u-1);
+    *(I_desc_curr++) = *(du2+u+0);
+    *(I_desc_curr++) = *(du2+u+0);
+    *(I_desc_curr++) = *(du2+u+1);
+    *(I_desc_curr++) = *(du3+u-2);
+    *(I_desc_curr++) = *(du3+u+0);
+    *(I_desc_curr++) = *(du3+u+2);
+    *(I_desc_curr++) = *(du4+u+0);
+    *(I_desc_curr++) = *(dv1+u+0);
+    *(I_desc_curr++) = *(dv2+u-1);
+    *(I_desc_curr++) = *(dv2+u+1);
+    *(I_desc_curr++) = *(dv3+u+0);
   }
-  
 }
@@ -21,6 +21,7 @@ libelas 是自由软件；你可以根据自由软件基金会发布的 GNU 通
 // 说明：该描述子是论文中 50 维描述子的稀疏近似，
 // 产生的结果与原描述子类似，
 // 但计算速度更快。
+// 精简模式（size = 8）只保留其中 8 个梯度值，描述子图像与匹配时的内存带宽减半。
 
 #ifndef __DESCRIPTOR_H__
 #define __DESCRIPTOR_H__
@@ -39,19 +40,56 @@ class Descriptor {
   
 public:
   
+  // 构造函数：创建空描述子，稍后通过 compute 填充（缓冲区在多帧之间复用）
+  Descriptor();
+
   // 构造函数：根据输入图像创建描述子
-  Descriptor(uint8_t* I,int32_t width,int32_t height,int32_t bpl,bool half_resolution);
+  Descriptor(uint8_t* I,int32_t width,int32_t height,int32_t bpl,bool half_resolution,int32_t size=16);
   
   // 析构函数：释放内部申请的内存
   ~Descriptor();
+
+  // 为给定尺寸准备缓冲区；尺寸不变时不会重新分配内存。
+  // half_resolution 时只存储偶数行：第 v 行（v 为偶数）位于 I_desc+(v/2)*width*size；
+  // size 为每个像素的描述子字节数（16 或 8）；band_rows>0 时只为 band_rows 行的条带分配空间（见 computeRows）
+  void reserve(int32_t width,int32_t height,int32_t bpl,bool half_resolution,int32_t size=16,int32_t band_rows=0);
+
+  // 根据输入图像（重新）计算描述子，复用已分配的缓冲区
+  void compute(const uint8_t* I,int32_t width,int32_t height,int32_t bpl,bool half_resolution,int32_t size=16);
+
+  // 只计算第 v_begin ... v_end-1 行的描述子（须先调用 reserve，行数不超过 band_rows，
+  // 半分辨率模式下 v_begin 为偶数）。第 v 行写在 I_desc 中第 v-v_begin 行的位置
+  // （半分辨率模式下为 (v-v_begin)/2），没有描述子的边界行填零。
+  void computeRows(const uint8_t* I,int32_t v_begin,int32_t v_end);
   
   // 外部可访问的描述子数据
   uint8_t* I_desc;
   
 private:
 
-  // 根据 I_du 和 I_dv 构建 I_desc 描述子
-  void createDescriptor(uint8_t* I_du,uint8_t* I_dv,int32_t width,int32_t height,int32_t bpl,bool half_resolution);
+  // 禁止拷贝（内部持有对齐缓冲区）
+  Descriptor(const Descriptor&);
+  Descriptor& operator=(const Descriptor&);
+
+  // 释放全部缓冲区
+  void release();
+
+  // 当前缓冲区对应的尺寸与行布局
+  int32_t width,height,bpl;
+  bool    half_resolution;
+  int32_t size;
+  int32_t row_begin;    // I_desc 第一行对应的图像行
+  int32_t stored_rows;  // I_desc 中存储的行数
+
+  // 滚动窗口：最近 5 行的 Sobel 梯度（第 r 行存放在 r%5 处），以及当前行的 16 位列滤波结果
+  uint8_t *du_rows,*dv_rows;
+  int16_t *col_v,*col_h;
+
+  // 计算第 v 行（1<=v<height-1）的 3x3 Sobel 梯度，写入滚动窗口
+  void computeGradientRow(const uint8_t* I,int32_t v);
+
+  // 由滚动窗口中的梯度行构建第 v 行的 I_desc 描述子（16 个像素一组，向量转置后写出）
+  void createDescriptorRow(int32_t v);
 
 };
 
@@ -21,157 +21,493 @@ libelas 是自由软件；你可以根据自由软件基金会发布的 GNU 通
 #include "elas.h"
 
 #include <algorithm>
+#include <chrono>
+#include <iomanip>
 #include <math.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
 #include "descriptor.h"
+#include "filter.h"
 #include "triangle.h"
-#include "matrix.h"
+#include "simd.h"
 
 using namespace std;
 
-void Elas::process (uint8_t* I1_,uint8_t* I2_,float* D1,float* D2,const int32_t* dims){
+// 各阶段的名称（与 Elas::Stats::stage 的顺序一致）
+static const char* g_stage_names[Elas::Stats::NUM_STAGES] = {
+  "Input","Descriptor","Support Matches","Delaunay Triangulation","Disparity Planes","Grid",
+  "Matching","L/R Consistency Check","Remove Small Segments","Gap Interpolation",
+  "Adaptive Mean","Median"
+};
+
+const char* Elas::Stats::stageName (int32_t s) {
+  return (s>=0 && s<NUM_STAGES) ? g_stage_names[s] : "";
+}
+
+void Elas::Stats::reset () {
+  for (int32_t i=0; i<NUM_STAGES; i++)
+    time_ns[i] = 0;
+  total_ns            = 0;
+  num_support_points  = 0;
+  num_triangles_left  = 0;
+  num_triangles_right = 0;
+  num_valid_left      = 0;
+  num_valid_right     = 0;
+  disp_range_min      = 0;
+  disp_range_max      = 0;
+}
+
+void Elas::Stats::print () const {
+  for (int32_t i=0; i<NUM_STAGES; i++) {
+    std::cout.width(30);
+    std::cout << stageName(i) << " ";
+    std::cout << std::fixed << std::setprecision(1) << std::setw(6);
+    std::cout << time_ns[i]*1e-6;
+    std::cout << " ms" << std::endl;
+  }
+  std::cout << "========================================" << std::endl;
+  std::cout << "                    Total time ";
+  std::cout << std::fixed << std::setprecision(1) << std::setw(6);
+  std::cout << total_ns*1e-6;
+  std::cout << " ms" << std::endl;
+  std::cout << "support points: " << num_support_points
+            << ", triangles: " << num_triangles_left << "/" << num_triangles_right
+            << ", valid pixels: " << num_valid_left << "/" << num_valid_right
+            << ", disparity range: " << disp_range_min << ".." << disp_range_max << std::endl << std::endl;
+}
+
+// 按阶段累计耗时（单调时钟）；stats 为空时不读取时钟，开销只有一次判断
+class StageTimer {
+public:
+  StageTimer (Elas::Stats* stats) : stats(stats),curr(-1) {
+    if (stats) stats->reset();
+  }
+  
+  // 结束当前阶段并开始新阶段
+  void start (int32_t stage) {
+    if (!stats) return;
+    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+    if (curr>=0) {
+      int64_t ns = chrono::duration_cast<chrono::nanoseconds>(now-t).count();
+      stats->time_ns[curr] += ns;
+      stats->total_ns      += ns;
+    }
+    curr = stage;
+    t    = now;
+  }
+  
+  // 结束当前阶段
+  void stop () {
+    start(-1);
+  }
+  
+private:
+  Elas::Stats* stats;
+  int32_t      curr;
+  chrono::steady_clock::time_point t;
+};
+
+Elas::Elas (parameters param) : param(param),use_avx2(param.simd_dispatch && simd::cpuSupportsAVX2()),
+  pool(max(param.num_threads,param.parallel_left_right ? 2 : 1)),
+  desc_size(param.descriptor_size==8 ? 8 : 16),
+  I1(0),I2(0),width(0),height(0),bpl(0),I1_src(0),I2_src(0),
+  ws_width(0),ws_height(0),D_can(0),D_can_prev(0),D_can_prev_valid(false),D_can_support(0),D_can_hist(0),
+  I1_pyr(0),I2_pyr(0),pyr_width(0),pyr_height(0),pyr_bpl(0),D_can_width(0),D_can_height(0),disp_lo(0),disp_hi(0),
+  disp_range_history(max(param.auto_disp_frames,1)),disp_range_count(0),disp_range_next(0),
+  disparity_grid_1(0),disparity_grid_2(0),grid_blocks(0),P(0),lr_rows(0) {
+  grid_dims[0] = grid_dims[1] = grid_dims[2] = 0;
+  for (int32_t i=0; i<2; i++) {
+    grid_temp1[i] = grid_temp2[i] = 0;
+    D_copy[i] = D_tmp[i] = 0;
+    tri_index[i] = 0;
+  }
+}
+
+Elas::~Elas () {
+  releaseWorkspace();
+}
+
+void Elas::releaseWorkspace () {
+  _mm_free(I1);
+  _mm_free(I2);
+  free(D_can);
+  free(D_can_prev);
+  free(D_can_support);
+  free(D_can_hist);
+  _mm_free(I1_pyr);
+  _mm_free(I2_pyr);
+  free(disparity_grid_1);
+  free(disparity_grid_2);
+  free(P);
+  free(lr_rows);
+  for (int32_t i=0; i<2; i++) {
+    _mm_free(grid_temp1[i]);
+    _mm_free(grid_temp2[i]);
+    free(D_copy[i]);
+    free(D_tmp[i]);
+    free(tri_index[i]);
+    grid_temp1[i] = grid_temp2[i] = 0;
+    D_copy[i] = D_tmp[i] = 0;
+    tri_index[i] = 0;
+  }
+  I1 = I2 = 0;
+  D_can = D_can_prev = 0;
+  D_can_support = D_can_hist = 0;
+  D_can_prev_valid = false;
+  I1_pyr = I2_pyr = 0;
+  disparity_grid_1 = disparity_grid_2 = 0;
+  P = 0;
+  lr_rows = 0;
+  ws_width = ws_height = 0;
+}
+
+void Elas::reserve (int32_t width_,int32_t height_) {
+  
+  // 尺寸未变化时直接复用已有缓冲区
+  if (I1 && ws_width==width_ && ws_height==height_)
+    return;
+  releaseWorkspace();
   
   // 获取图像宽度、高度以及每行字节数
-  width  = dims[0];
-  height = dims[1];
-  bpl    = width + 15-(width-1)%16;
+  width     = width_;
+  height    = height_;
+  bpl       = width + 15-(width-1)%16;
+  ws_width  = width;
+  ws_height = height;
   
-  // 将图像拷贝到按 16 字节对齐的缓冲区
+  // 按 16 字节对齐的输入图像缓冲区（行尾填充部分保持为 0）
   I1 = (uint8_t*)_mm_malloc(bpl*height*sizeof(uint8_t),16);
   I2 = (uint8_t*)_mm_malloc(bpl*height*sizeof(uint8_t),16);
   memset (I1,0,bpl*height*sizeof(uint8_t));
   memset (I2,0,bpl*height*sizeof(uint8_t));
-  if (bpl==dims[2]) {
-    memcpy(I1,I1_,bpl*height*sizeof(uint8_t));
-    memcpy(I2,I2_,bpl*height*sizeof(uint8_t));
-  } else {
-    for (int32_t v=0; v<height; v++) {
-      memcpy(I1+v*bpl,I1_+v*dims[2],width*sizeof(uint8_t));
-      memcpy(I2+v*bpl,I2_+v*dims[2],width*sizeof(uint8_t));
-    }
+  
+  // 描述子
+  // （条带流式处理时只需容纳一个条带，支持点匹配的条带为 5 行）
+  int32_t desc_rows = 0;
+  if (param.band_height>0)
+    desc_rows = max(param.band_height+param.band_height%2,6);
+  desc1.reserve(width,height,bpl,param.subsampling,desc_size,desc_rows);
+  desc2.reserve(width,height,bpl,param.subsampling,desc_size,desc_rows);
+  
+  // 由粗到精搜索的降采样图像及其整幅描述子
+  if (param.support_pyramid) {
+    pyr_width  = width/2;
+    pyr_height = height/2;
+    pyr_bpl    = pyr_width + 15-(pyr_width-1)%16;
+    I1_pyr = (uint8_t*)_mm_malloc(pyr_bpl*pyr_height*sizeof(uint8_t),16);
+    I2_pyr = (uint8_t*)_mm_malloc(pyr_bpl*pyr_height*sizeof(uint8_t),16);
+    memset (I1_pyr,0,pyr_bpl*pyr_height*sizeof(uint8_t));
+    memset (I2_pyr,0,pyr_bpl*pyr_height*sizeof(uint8_t));
+    desc1_pyr.reserve(pyr_width,pyr_height,pyr_bpl,false,desc_size);
+    desc2_pyr.reserve(pyr_width,pyr_height,pyr_bpl,false,desc_size);
+  }
+  
+  // 支持点候选网格（半分辨率模式下只需要使用每隔一行的数据）
+  int32_t D_candidate_stepsize = param.candidate_stepsize;
+  if (param.subsampling)
+    D_candidate_stepsize += D_candidate_stepsize%2;
+  D_can_width  = 0;
+  D_can_height = 0;
+  for (int32_t u=0; u<width;  u+=D_candidate_stepsize) D_can_width++;
+  for (int32_t v=0; v<height; v+=D_candidate_stepsize) D_can_height++;
+  D_can = (int16_t*)malloc(D_can_width*D_can_height*sizeof(int16_t));
+  if (param.temporal_support)
+    D_can_prev = (int16_t*)malloc(D_can_width*D_can_height*sizeof(int16_t));
+  D_can_support = (int32_t*)malloc(D_can_width*D_can_height*sizeof(int32_t));
+  D_can_hist    = (int32_t*)malloc((param.disp_max+1)*sizeof(int32_t));
+  p_support.reserve(D_can_width*D_can_height+6);
+  
+  // 视差网格及 createGrid 的临时网格
+  int32_t grid_width  = (int32_t)ceil((float)width/(float)param.grid_size);
+  int32_t grid_height = (int32_t)ceil((float)height/(float)param.grid_size);
+  grid_dims[0] = param.disp_max+2;
+  grid_dims[1] = grid_width;
+  grid_dims[2] = grid_height;
+  grid_blocks  = (param.disp_max+128)/128;
+  disp_lo      = 0;
+  disp_hi      = param.disp_max;
+  disparity_grid_1 = (uint16_t*)malloc((param.disp_max+2)*grid_height*grid_width*sizeof(uint16_t));
+  disparity_grid_2 = (uint16_t*)malloc((param.disp_max+2)*grid_height*grid_width*sizeof(uint16_t));
+  for (int32_t i=0; i<(param.parallel_left_right?2:1); i++) {
+    grid_temp1[i] = (__m128i*)_mm_malloc(grid_blocks*grid_height*grid_width*sizeof(__m128i),16);
+    grid_temp2[i] = (__m128i*)_mm_malloc(grid_blocks*grid_height*grid_width*sizeof(__m128i),16);
+  }
+  
+  // 预先计算视差差的先验代价
+  int32_t disp_num = grid_dims[0]-1;
+  float two_sigma_squared = 2*param.sigma*param.sigma;
+  P = (int32_t*)malloc(disp_num*sizeof(int32_t));
+  for (int32_t delta_d=0; delta_d<disp_num; delta_d++)
+    P[delta_d] = (int32_t)((-log(param.gamma+exp(-delta_d*delta_d/two_sigma_squared))+log(param.gamma))/param.beta);
+  
+  // 后处理使用的视差图大小的临时缓冲区
+  int32_t D_width  = width;
+  int32_t D_height = height;
+  if (param.subsampling) {
+    D_width  = width/2;
+    D_height = height/2;
+  }
+  // （并行后处理时右图另有一套）
+  bool parallel_post = param.parallel_left_right && !param.postprocess_only_left;
+  if (param.filter_adaptive_mean)
+    for (int32_t i=0; i<(parallel_post?2:1); i++)
+      D_copy[i] = (float*)malloc(D_width*D_height*sizeof(float));
+  
+  // 一致性检查每个任务使用的一行左右视差拷贝
+  lr_rows = (float*)malloc(max(param.num_threads,1)*2*D_width*sizeof(float));
+  if (param.scanline_matching)
+    for (int32_t i=0; i<(param.parallel_left_right?2:1); i++)
+      tri_index[i] = (int32_t*)malloc(D_width*D_height*sizeof(int32_t));
+  for (int32_t i=0; i<(parallel_post?2:1); i++) {
+    D_tmp[i]    = (float*)malloc(D_width*D_height*sizeof(float));
+    
+    // removeSmallSegments 的条带划分（各线程一个条带）
+    int32_t num_bands = max(min(param.num_threads,D_height),1);
+    seg_runs[i].resize(num_bands);
+    seg_band_v[i].resize(num_bands+1);
+    seg_offset[i].resize(num_bands+1);
+    for (int32_t b=0; b<=num_bands; b++)
+      seg_band_v[i][b] = (int32_t)((int64_t)D_height*b/num_bands);
+    for (int32_t b=0; b<num_bands; b++)
+      seg_runs[i][b].row_begin.resize(seg_band_v[i][b+1]-seg_band_v[i][b]+1);
   }
+}
 
-#ifdef PROFILE
-  timer.start("Descriptor");  
-#endif
-  Descriptor desc1(I1,width,height,bpl,param.subsampling);
-  Descriptor desc2(I2,width,height,bpl,param.subsampling);
+bool Elas::acceptsInputInPlace (const uint8_t* I1,const uint8_t* I2,const int32_t* dims) {
+  int32_t bpl = dims[0] + 15-(dims[0]-1)%16;
+  return dims[2]==bpl && ((uintptr_t)I1&15)==0 && ((uintptr_t)I2&15)==0;
+}
 
+void Elas::resetTemporal () {
+  D_can_prev_valid = false;
+  disp_range_count = 0;
+  disp_range_next  = 0;
+}
+
+void Elas::process (uint8_t* I1_,uint8_t* I2_,float* D1,float* D2,const int32_t* dims,Stats* stats){
+  
+  // 编译时定义 PROFILE 且调用者未要求统计时，仍然记录并在结束时打印各阶段耗时
 #ifdef PROFILE
-  timer.start("Support Matches");
+  Stats profile_stats;
+  if (!stats) stats = &profile_stats;
 #endif
-  vector<support_pt> p_support = computeSupportMatches(desc1.I_desc,desc2.I_desc);
+  StageTimer timer(stats);
+  timer.start(Stats::INPUT);
+  
+  // 准备（或复用）与图像尺寸对应的工作缓冲区
+  reserve(dims[0],dims[1]);
+  
+  // 调用者的图像已经对齐且行宽合适时直接使用，否则拷贝到按 16 字节对齐的缓冲区。
+  // 描述子只使用第 0 ... width-1 列像素的梯度，行尾填充的内容不影响结果，
+  // 因此拷贝时只需逐行复制有效像素（填充部分在 reserve 中清零）
+  if (acceptsInputInPlace(I1_,I2_,dims)) {
+    I1_src = I1_;
+    I2_src = I2_;
+  } else {
+    if (bpl==dims[2]) {
+      memcpy(I1,I1_,bpl*height*sizeof(uint8_t));
+      memcpy(I2,I2_,bpl*height*sizeof(uint8_t));
+    } else {
+      for (int32_t v=0; v<height; v++) {
+        memcpy(I1+v*bpl,I1_+v*dims[2],width*sizeof(uint8_t));
+        memcpy(I2+v*bpl,I2_+v*dims[2],width*sizeof(uint8_t));
+      }
+    }
+    I1_src = I1;
+    I2_src = I2;
+  }
+
+  // 左右两条处理链互相独立时可以并行执行
+  bool parallel          = param.parallel_left_right;
+  bool postprocess_right = !param.postprocess_only_left;
+  bool parallel_post     = parallel && postprocess_right;
+  int32_t buf_right      = parallel_post ? 1 : 0;  // 右图后处理使用的临时缓冲区组
+
+  bool streaming = param.band_height>0;
+  bool pyramid   = param.support_pyramid;
+  if (!streaming || pyramid) {
+    timer.start(Stats::DESCRIPTOR);
+    pool.invoke(parallel,
+      [&]() {
+        if (!streaming) desc1.compute(I1_src,width,height,bpl,param.subsampling,desc_size);
+        if (pyramid)    computePyramidLevel(I1_src,I1_pyr,desc1_pyr);
+      },
+      [&]() {
+        if (!streaming) desc2.compute(I2_src,width,height,bpl,param.subsampling,desc_size);
+        if (pyramid)    computePyramidLevel(I2_src,I2_pyr,desc2_pyr);
+      });
+  }
+
+  timer.start(Stats::SUPPORT_MATCHES);
+  computeSupportMatches(desc1.I_desc,desc2.I_desc,p_support);
   
   // 如果支持点数量不足以进行三角剖分
   if (p_support.size()<3) {
     cout << "ERROR: Need at least 3 support points!" << endl;
-    _mm_free(I1);
-    _mm_free(I2);
+    timer.stop();
+    if (stats) stats->num_support_points = p_support.size();
     return;
   }
-
-#ifdef PROFILE
-  timer.start("Delaunay Triangulation");
-#endif
-  vector<triangle> tri_1 = computeDelaunayTriangulation(p_support,0);
-  vector<triangle> tri_2 = computeDelaunayTriangulation(p_support,1);
-
-#ifdef PROFILE
-  timer.start("Disparity Planes");
-#endif
-  computeDisparityPlanes(p_support,tri_1,0);
-  computeDisparityPlanes(p_support,tri_2,1);
-
-#ifdef PROFILE
-  timer.start("Grid");
-#endif
-
-  // 为视差网格分配内存
-  int32_t grid_width   = (int32_t)ceil((float)width/(float)param.grid_size);
-  int32_t grid_height  = (int32_t)ceil((float)height/(float)param.grid_size);
-  int32_t grid_dims[3] = {param.disp_max+2,grid_width,grid_height};
-  int32_t* disparity_grid_1 = (int32_t*)calloc((param.disp_max+2)*grid_height*grid_width,sizeof(int32_t));
-  int32_t* disparity_grid_2 = (int32_t*)calloc((param.disp_max+2)*grid_height*grid_width,sizeof(int32_t));
   
-  createGrid(p_support,disparity_grid_1,grid_dims,0);
-  createGrid(p_support,disparity_grid_2,grid_dims,1);
-
-#ifdef PROFILE
-  timer.start("Matching");
-#endif
-  computeDisparity(p_support,tri_1,disparity_grid_1,grid_dims,desc1.I_desc,desc2.I_desc,0,D1);
-  computeDisparity(p_support,tri_2,disparity_grid_2,grid_dims,desc1.I_desc,desc2.I_desc,1,D2);
-
-#ifdef PROFILE
-  timer.start("L/R Consistency Check");
-#endif
-  leftRightConsistencyCheck(D1,D2);
+  // 由支持点确定稠密匹配的视差范围（视差网格与候选列表随之缩小）
+  if (param.auto_disp_range)
+    updateDisparityRange(p_support);
+
+  timer.start(Stats::DELAUNAY);
+  pool.invoke(parallel,
+    [&]() { computeDelaunayTriangulation(p_support,0,tri_1); },
+    [&]() { computeDelaunayTriangulation(p_support,1,tri_2); });
+
+  timer.start(Stats::PLANES);
+  pool.invoke(parallel,
+    [&]() { computeDisparityPlanes(p_support,tri_1,0); },
+    [&]() { computeDisparityPlanes(p_support,tri_2,1); });
+
+  timer.start(Stats::GRID);
+  pool.invoke(parallel,
+    [&]() { createGrid(p_support,disparity_grid_1,grid_dims,0); },
+    [&]() { createGrid(p_support,disparity_grid_2,grid_dims,1); });
+
+  int32_t D_height = param.subsampling ? height/2 : height;
+  if (!streaming) {
+    timer.start(Stats::MATCHING);
+    pool.invoke(parallel,
+      [&]() { computeDisparity(p_support,tri_1,disparity_grid_1,grid_dims,desc1.I_desc,desc2.I_desc,0,D1,0,height); },
+      [&]() { computeDisparity(p_support,tri_2,disparity_grid_2,grid_dims,desc1.I_desc,desc2.I_desc,1,D2,0,height); });
+
+    timer.start(Stats::LR_CHECK);
+    leftRightConsistencyCheck(D1,D2,0,D_height);
+    
+  // 条带流式处理：每个条带依次计算描述子、左右稠密匹配和一致性检查，
+  // 条带的数据在下一阶段使用时仍留在缓存中。各行的匹配与一致性检查只依赖本行的
+  // 描述子与视差，因此条带之间不需要重叠的边缘行
+  } else {
+    int32_t band = param.band_height+param.band_height%2;
+    for (int32_t v_begin=0; v_begin<height; v_begin+=band) {
+      int32_t v_end = min(v_begin+band,height);
+      
+      // 全分辨率模式下 findMatch 把行号截断到 [2,height-3]，所需的描述子行随之截断
+      int32_t desc_begin = v_begin;
+      int32_t desc_end   = v_end;
+      if (!param.subsampling) {
+        desc_begin = max(min(v_begin,height-3),2);
+        desc_end   = max(min(v_end-1,height-3),2)+1;
+      }
+      uint8_t *I1_desc,*I2_desc;
+      timer.start(Stats::DESCRIPTOR);
+      computeDescriptorBand(desc_begin,desc_end,I1_desc,I2_desc);
+      timer.start(Stats::MATCHING);
+      pool.invoke(parallel,
+        [&]() { computeDisparity(p_support,tri_1,disparity_grid_1,grid_dims,I1_desc,I2_desc,0,D1,v_begin,v_end); },
+        [&]() { computeDisparity(p_support,tri_2,disparity_grid_2,grid_dims,I1_desc,I2_desc,1,D2,v_begin,v_end); });
+      timer.start(Stats::LR_CHECK);
+      if (param.subsampling) leftRightConsistencyCheck(D1,D2,v_begin/2,min((v_end+1)/2,D_height));
+      else                   leftRightConsistencyCheck(D1,D2,v_begin,v_end);
+    }
+  }
 
-#ifdef PROFILE
-  timer.start("Remove Small Segments");
-#endif
-  removeSmallSegments(D1);
-  if (!param.postprocess_only_left)
-    removeSmallSegments(D2);
+  timer.start(Stats::SEGMENTS);
+  pool.invoke(parallel_post,
+    [&]() { removeSmallSegments(D1,0); },
+    [&]() { if (postprocess_right) removeSmallSegments(D2,buf_right); });
 
-#ifdef PROFILE
-  timer.start("Gap Interpolation");
-#endif
-  gapInterpolation(D1);
-  if (!param.postprocess_only_left)
-    gapInterpolation(D2);
+  timer.start(Stats::INTERPOLATION);
+  pool.invoke(parallel_post,
+    [&]() { gapInterpolation(D1); },
+    [&]() { if (postprocess_right) gapInterpolation(D2); });
 
   if (param.filter_adaptive_mean) {
-#ifdef PROFILE
-    timer.start("Adaptive Mean");
-#endif
-    adaptiveMean(D1);
-    if (!param.postprocess_only_left)
-      adaptiveMean(D2);
+    timer.start(Stats::ADAPTIVE_MEAN);
+    pool.invoke(parallel_post,
+      [&]() { adaptiveMean(D1,0); },
+      [&]() { if (postprocess_right) adaptiveMean(D2,buf_right); });
   }
 
   if (param.filter_median) {
-#ifdef PROFILE
-    timer.start("Median");
-#endif
-    median(D1);
-    if (!param.postprocess_only_left)
-      median(D2);
+    timer.start(Stats::MEDIAN);
+    pool.invoke(parallel_post,
+      [&]() { median(D1,0); },
+      [&]() { if (postprocess_right) median(D2,buf_right); });
+  }
+
+  timer.stop();
+  
+  // 统计量（仅在需要时遍历视差图）
+  if (stats) {
+    stats->num_support_points  = p_support.size();
+    stats->num_triangles_left  = tri_1.size();
+    stats->num_triangles_right = tri_2.size();
+    stats->disp_range_min      = disp_lo;
+    stats->disp_range_max      = disp_hi;
+    int32_t D_size = param.subsampling ? (width/2)*(height/2) : width*height;
+    for (int32_t i=0; i<D_size; i++) {
+      if (D1[i]>=0) stats->num_valid_left++;
+      if (D2[i]>=0) stats->num_valid_right++;
+    }
   }
 
 #ifdef PROFILE
-  timer.plot();
+  stats->print();
 #endif
-
-  // 释放内存
-  free(disparity_grid_1);
-  free(disparity_grid_2);
-  _mm_free(I1);
-  _mm_free(I2);
 }
 
 void Elas::removeInconsistentSupportPoints (int16_t* D_can,int32_t D_can_width,int32_t D_can_height) {
   
-  // 遍历所有有效的支持点
-  for (int32_t u_can=0; u_can<D_can_width; u_can++) {
-    for (int32_t v_can=0; v_can<D_can_height; v_can++) {
+  // 按列优先顺序逐点判定，被剔除的点立即从后续点的邻域统计中消失。
+  // 先用滑动窗口在原始网格上统计每个点的一致邻点数（含自身），
+  // 再按同样的顺序判定；每剔除一个点，就把它从尚未判定的邻点的计数中减去，
+  // 结果与逐点遍历整个邻域完全一致
+  const int32_t w     = param.incon_window_size;
+  const int32_t thr   = param.incon_threshold;
+  const int32_t d_max = param.disp_max;
+  int32_t *count = D_can_support;
+  int32_t *hist  = D_can_hist;
+  
+  // 第一步：逐行滑动 (2w+1)x(2w+1) 窗口，hist[d] 为窗口内视差为 d 的有效点个数
+  for (int32_t v_can=0; v_can<D_can_height; v_can++) {
+    int32_t v_can_min = max(v_can-w,0);
+    int32_t v_can_max = min(v_can+w,D_can_height-1);
+    memset(hist,0,(d_max+1)*sizeof(int32_t));
+    auto add_column = [&](int32_t u_can_2,int32_t delta) {
+      for (int32_t v_can_2=v_can_min; v_can_2<=v_can_max; v_can_2++) {
+        int16_t d_can_2 = *(D_can+getAddressOffsetImage(u_can_2,v_can_2,D_can_width));
+        if (d_can_2>=0)
+          hist[d_can_2] += delta;
+      }
+    };
+    for (int32_t u_can_2=0; u_can_2<=min(w,D_can_width-1); u_can_2++)
+      add_column(u_can_2,+1);
+    for (int32_t u_can=0; u_can<D_can_width; u_can++) {
       int16_t d_can = *(D_can+getAddressOffsetImage(u_can,v_can,D_can_width));
       if (d_can>=0) {
-        
-        // 统计在邻域内与当前支持点视差接近的点的数量
         int32_t support = 0;
-        for (int32_t u_can_2=u_can-param.incon_window_size; u_can_2<=u_can+param.incon_window_size; u_can_2++) {
-          for (int32_t v_can_2=v_can-param.incon_window_size; v_can_2<=v_can+param.incon_window_size; v_can_2++) {
-            if (u_can_2>=0 && v_can_2>=0 && u_can_2<D_can_width && v_can_2<D_can_height) {
-              int16_t d_can_2 = *(D_can+getAddressOffsetImage(u_can_2,v_can_2,D_can_width));
-              if (d_can_2>=0 && abs(d_can-d_can_2)<=param.incon_threshold)
-                support++;
-            }
-          }
+        for (int32_t d=max(d_can-thr,0); d<=min(d_can+thr,d_max); d++)
+          support += hist[d];
+        *(count+getAddressOffsetImage(u_can,v_can,D_can_width)) = support;
+      }
+      if (u_can-w>=0)            add_column(u_can-w,-1);
+      if (u_can+w+1<D_can_width) add_column(u_can+w+1,+1);
+    }
+  }
+  
+  // 第二步：按原始顺序判定
+  for (int32_t u_can=0; u_can<D_can_width; u_can++) {
+    for (int32_t v_can=0; v_can<D_can_height; v_can++) {
+      int16_t d_can = *(D_can+getAddressOffsetImage(u_can,v_can,D_can_width));
+      if (d_can<0 || *(count+getAddressOffsetImage(u_can,v_can,D_can_width))>=param.incon_min_support)
+        continue;
+      
+      // 邻域内支持当前点的数量过少，将该支持点标记为无效，
+      // 并从其后才判定的邻点（同列下方及右侧各列）的计数中减去
+      *(D_can+getAddressOffsetImage(u_can,v_can,D_can_width)) = -1;
+      for (int32_t u_can_2=u_can; u_can_2<=min(u_can+w,D_can_width-1); u_can_2++) {
+        int32_t v_can_2_min = u_can_2==u_can ? v_can+1 : max(v_can-w,0);
+        for (int32_t v_can_2=v_can_2_min; v_can_2<=min(v_can+w,D_can_height-1); v_can_2++) {
+          int16_t d_can_2 = *(D_can+getAddressOffsetImage(u_can_2,v_can_2,D_can_width));
+          if (d_can_2>=0 && abs(d_can-d_can_2)<=thr)
+            (*(count+getAddressOffsetImage(u_can_2,v_can_2,D_can_width)))--;
         }
-        
-        // 若邻域内支持当前点的数量过少，则将该支持点标记为无效
-        if (support<param.incon_min_support)
-          *(D_can+getAddressOffsetImage(u_can,v_can,D_can_width)) = -1;
       }
     }
   }
@@ -235,15 +571,13 @@ void Elas::removeRedundantSupportPoints(int16_t* D_can,int32_t D_can_width,int32
 
 void Elas::addCornerSupportPoints(vector<support_pt> &p_support) {
   
-  // 图像边界上的四个角点
-  vector<support_pt> p_border;
-  p_border.push_back(support_pt(0,0,0));
-  p_border.push_back(support_pt(0,height-1,0));
-  p_border.push_back(support_pt(width-1,0,0));
-  p_border.push_back(support_pt(width-1,height-1,0));
+  // 图像边界上的四个角点（以及后面补充的两个右图角点）
+  support_pt p_border[6] = {support_pt(0,0,0),support_pt(0,height-1,0),
+                            support_pt(width-1,0,0),support_pt(width-1,height-1,0),
+                            support_pt(0,0,0),support_pt(0,0,0)};
   
   // 为每个角点找到最近的支持点视差
-  for (int32_t i=0; i<p_border.size(); i++) {
+  for (int32_t i=0; i<4; i++) {
     int32_t best_dist = 10000000;
     for (int32_t j=0; j<p_support.size(); j++) {
       int32_t du = p_border[i].u-p_support[j].u;
@@ -257,32 +591,40 @@ void Elas::addCornerSupportPoints(vector<support_pt> &p_support) {
   }
   
   // 右图中的角点（u 需要加上视差）
-  p_border.push_back(support_pt(p_border[2].u+p_border[2].d,p_border[2].v,p_border[2].d));
-  p_border.push_back(support_pt(p_border[3].u+p_border[3].d,p_border[3].v,p_border[3].d));
+  p_border[4] = support_pt(p_border[2].u+p_border[2].d,p_border[2].v,p_border[2].d);
+  p_border[5] = support_pt(p_border[3].u+p_border[3].d,p_border[3].v,p_border[3].d);
   
   // 将角点加入支持点集合
-  for (int32_t i=0; i<p_border.size(); i++)
+  for (int32_t i=0; i<6; i++)
     p_support.push_back(p_border[i]);
 }
 
-inline int16_t Elas::computeMatchingDisparity (const int32_t &u,const int32_t &v,uint8_t* I1_desc,uint8_t* I2_desc,const bool &right_image) {
+inline int16_t Elas::computeMatchingDisparity (const int32_t &u,const int32_t &v,uint8_t* I1_desc,uint8_t* I2_desc,const bool &right_image,
+                                               const int32_t &d_lo,const int32_t &d_hi,const bool &coarse) {
   
   const int32_t u_step      = 2;
   const int32_t v_step      = 2;
   const int32_t window_size = 3;
   
-  int32_t desc_offset_1 = -16*u_step-16*width*v_step;
-  int32_t desc_offset_2 = +16*u_step-16*width*v_step;
-  int32_t desc_offset_3 = -16*u_step+16*width*v_step;
-  int32_t desc_offset_4 = +16*u_step+16*width*v_step;
+  // 由粗到精搜索的粗层：(u,v) 为降采样图像坐标，描述子按整幅行存储，视差范围减半
+  const int32_t lvl_width    = coarse ? pyr_width  : width;
+  const int32_t lvl_height   = coarse ? pyr_height : height;
+  const int32_t lvl_disp_min = coarse ? param.disp_min/2     : param.disp_min;
+  const int32_t lvl_disp_max = coarse ? (param.disp_max+1)/2 : param.disp_max;
+  const int32_t v_offset     = coarse ? desc_size*pyr_width*v_step : descLineOffset(v_step);
+  
+  int32_t desc_offset_1 = -desc_size*u_step-v_offset;
+  int32_t desc_offset_2 = +desc_size*u_step-v_offset;
+  int32_t desc_offset_3 = -desc_size*u_step+v_offset;
+  int32_t desc_offset_4 = +desc_size*u_step+v_offset;
   
   __m128i xmm1,xmm2,xmm3,xmm4,xmm5,xmm6;
 
   // 检查当前 (u, v) 是否在可匹配的图像区域内
-  if (u>=window_size+u_step && u<=width-window_size-1-u_step && v>=window_size+v_step && v<=height-window_size-1-v_step) {
+  if (u>=window_size+u_step && u<=lvl_width-window_size-1-u_step && v>=window_size+v_step && v<=lvl_height-window_size-1-v_step) {
     
     // 计算描述子数据和行起始地址
-    int32_t  line_offset = 16*width*v;
+    int32_t  line_offset = coarse ? desc_size*pyr_width*v : descLineOffset(v);
     uint8_t *I1_line_addr,*I2_line_addr;
     if (!right_image) {
       I1_line_addr = I1_desc+line_offset;
@@ -293,21 +635,19 @@ inline int16_t Elas::computeMatchingDisparity (const int32_t &u,const int32_t &v
     }
 
     // 计算 I1 中当前块的起始地址
-    uint8_t* I1_block_addr = I1_line_addr+16*u;
+    uint8_t* I1_block_addr = I1_line_addr+desc_size*u;
     uint8_t* I2_block_addr;
     
     // 要求该块具有一定的纹理强度
-    int32_t sum = 0;
-    for (int32_t i=0; i<16; i++)
-      sum += abs((int32_t)(*(I1_block_addr+i))-128);
+    int32_t sum = descriptorTexture(I1_block_addr);
     if (sum<param.support_texture)
       return -1;
     
     // 将 I1 中前四个 4×4 描述子块加载到寄存器
-    xmm1 = _mm_load_si128((__m128i*)(I1_block_addr+desc_offset_1));
-    xmm2 = _mm_load_si128((__m128i*)(I1_block_addr+desc_offset_2));
-    xmm3 = _mm_load_si128((__m128i*)(I1_block_addr+desc_offset_3));
-    xmm4 = _mm_load_si128((__m128i*)(I1_block_addr+desc_offset_4));
+    xmm1 = loadDescriptor(I1_block_addr+desc_offset_1);
+    xmm2 = loadDescriptor(I1_block_addr+desc_offset_2);
+    xmm3 = loadDescriptor(I1_block_addr+desc_offset_3);
+    xmm4 = loadDescriptor(I1_block_addr+desc_offset_4);
     
     // 为每个候选视差准备匹配代价值
     int32_t u_warp;
@@ -319,14 +659,40 @@ inline int16_t Elas::computeMatchingDisparity (const int32_t &u,const int32_t &v
     int16_t min_2_d = -1;
 
     // 计算当前像素可用的视差范围
-    int32_t disp_min_valid = max(param.disp_min,0);
-    int32_t disp_max_valid = param.disp_max;
-    if (!right_image) disp_max_valid = min(param.disp_max,u-window_size-u_step);
-    else              disp_max_valid = min(param.disp_max,width-u-window_size-u_step);
+    int32_t disp_min_valid = max(lvl_disp_min,0);
+    int32_t disp_max_valid = lvl_disp_max;
+    if (!right_image) disp_max_valid = min(lvl_disp_max,u-window_size-u_step);
+    else              disp_max_valid = min(lvl_disp_max,lvl_width-u-window_size-u_step);
     
     // 要求该像素至少可以评估 10 个不同视差，否则视为无效
     if (disp_max_valid-disp_min_valid<10)
       return -1;
+    
+    // 时域预热时只搜索 [d_lo,d_hi] 窗口；最优视差落在被截断的窗口边界上时，
+    // 真实的最优值可能在窗口之外，此时同样视为无效（由调用者退回全范围搜索）
+    int32_t search_min = max(disp_min_valid,d_lo);
+    int32_t search_max = min(disp_max_valid,d_hi);
+    if (search_max<=search_min)
+      return -1;
+    auto at_window_edge = [&](int32_t d) {
+      return (d==search_min && search_min>disp_min_valid) || (d==search_max && search_max<disp_max_valid);
+    };
+    disp_min_valid = search_min;
+    disp_max_valid = search_max;
+
+    // AVX2：每条 SAD 指令同时计算两个候选视差的代价
+    if (use_avx2) {
+      int32_t desc_offset[4] = {desc_offset_1,desc_offset_2,desc_offset_3,desc_offset_4};
+      int32_t E1,d1,E2;
+      if (!right_image) u_warp = u-disp_min_valid;
+      else              u_warp = u+disp_min_valid;
+      simd::supportMatchAVX2(I1_block_addr,I2_line_addr+desc_size*u_warp,right_image?desc_size:-desc_size,desc_offset,
+                             disp_min_valid,disp_max_valid-disp_min_valid+1,desc_size,E1,d1,E2);
+      if (d1>=0 && E2<32767 && (float)E1<param.support_threshold*(float)E2 && !at_window_edge(d1))
+        return d1;
+      else
+        return -1;
+    }
 
     // 遍历所有候选视差
     for (int16_t d=disp_min_valid; d<=disp_max_valid; d++) {
@@ -336,16 +702,16 @@ inline int16_t Elas::computeMatchingDisparity (const int32_t &u,const int32_t &v
       else              u_warp = u+d;
 
       // 计算右图中匹配块的起始地址
-      I2_block_addr = I2_line_addr+16*u_warp;
+      I2_block_addr = I2_line_addr+desc_size*u_warp;
 
       // 在该视差下计算匹配代价
-      xmm6 = _mm_load_si128((__m128i*)(I2_block_addr+desc_offset_1));
+      xmm6 = loadDescriptor(I2_block_addr+desc_offset_1);
       xmm6 = _mm_sad_epu8(xmm1,xmm6);
-      xmm5 = _mm_load_si128((__m128i*)(I2_block_addr+desc_offset_2));
+      xmm5 = loadDescriptor(I2_block_addr+desc_offset_2);
       xmm6 = _mm_add_epi16(_mm_sad_epu8(xmm2,xmm5),xmm6);
-      xmm5 = _mm_load_si128((__m128i*)(I2_block_addr+desc_offset_3));
+      xmm5 = loadDescriptor(I2_block_addr+desc_offset_3);
       xmm6 = _mm_add_epi16(_mm_sad_epu8(xmm3,xmm5),xmm6);
-      xmm5 = _mm_load_si128((__m128i*)(I2_block_addr+desc_offset_4));
+      xmm5 = loadDescriptor(I2_block_addr+desc_offset_4);
       xmm6 = _mm_add_epi16(_mm_sad_epu8(xmm4,xmm5),xmm6);
       sum  = _mm_extract_epi16(xmm6,0)+_mm_extract_epi16(xmm6,4);
 
@@ -362,7 +728,7 @@ inline int16_t Elas::computeMatchingDisparity (const int32_t &u,const int32_t &v
     }
 
     // 检查是否同时存在最佳与次佳匹配，且代价比满足唯一性约束
-    if (min_1_d>=0 && min_2_d>=0 && (float)min_1_E<param.support_threshold*(float)min_2_E)
+    if (min_1_d>=0 && min_2_d>=0 && (float)min_1_E<param.support_threshold*(float)min_2_E && !at_window_edge(min_1_d))
       return min_1_d;
     else
       return -1;
@@ -371,45 +737,108 @@ inline int16_t Elas::computeMatchingDisparity (const int32_t &u,const int32_t &v
     return -1;
 }
 
-vector<Elas::support_pt> Elas::computeSupportMatches (uint8_t* I1_desc,uint8_t* I2_desc) {
+void Elas::computeSupportMatches (uint8_t* I1_desc,uint8_t* I2_desc,vector<support_pt> &p_support) {
   
   // 注意：在半分辨率模式下，只需要使用每隔一行的数据
   int32_t D_candidate_stepsize = param.candidate_stepsize;
   if (param.subsampling)
     D_candidate_stepsize += D_candidate_stepsize%2;
 
-  // 为视差候选结果创建矩阵
-  int32_t D_can_width  = 0;
-  int32_t D_can_height = 0;
-  for (int32_t u=0; u<width;  u+=D_candidate_stepsize) D_can_width++;
-  for (int32_t v=0; v<height; v+=D_candidate_stepsize) D_can_height++;
-  int16_t* D_can = (int16_t*)calloc(D_can_width*D_can_height,sizeof(int16_t));
+  // 视差候选结果矩阵（尺寸由 reserve 确定）
+  memset(D_can,0,D_can_width*D_can_height*sizeof(int16_t));
 
-  // 循环变量
-  int32_t u,v;
-  int16_t d,d2;
-   
-  // 遍历图像 1 中所有候选点
-  for (int32_t u_can=1; u_can<D_can_width; u_can++) {
-    u = u_can*D_candidate_stepsize;
-    for (int32_t v_can=1; v_can<D_can_height; v_can++) {
-      v = v_can*D_candidate_stepsize;
+  // 是否使用上一帧的候选视差预热（半径不足 5 时窗口内无法可靠地进行唯一性检验）
+  bool temporal = param.temporal_support && D_can_prev_valid && param.temporal_radius>=5;
+  
+  // 由粗到精搜索：粗层的描述子已在 process 中计算
+  bool    pyramid = param.support_pyramid;
+  int32_t radius  = max(param.pyramid_radius,1);
+  uint8_t *I1_desc_pyr = desc1_pyr.I_desc;
+  uint8_t *I2_desc_pyr = desc2_pyr.I_desc;
+  
+  // 匹配第 v_can 行中第 u_can_begin ... u_can_end-1 个候选点。
+  // 每个候选点只写入 D_can 中自己的位置，因此可以在多个线程上并行执行
+  auto match_row = [&](int32_t v_can,int32_t u_can_begin,int32_t u_can_end,uint8_t* I1_desc,uint8_t* I2_desc) {
+    int32_t v = v_can*D_candidate_stepsize;
+    for (int32_t u_can=u_can_begin; u_can<u_can_end; u_can++) {
+      int32_t u = u_can*D_candidate_stepsize;
       
       // 将该候选点的视差初始化为无效
       *(D_can+getAddressOffsetImage(u_can,v_can,D_can_width)) = -1;
       
+      // 时域预热：先在上一帧视差附近的窗口内匹配（左→右，再右→左验证），
+      // 失败时退回下面的全范围搜索
+      if (temporal) {
+        int16_t d_prev = *(D_can_prev+getAddressOffsetImage(u_can,v_can,D_can_width));
+        if (d_prev>=0) {
+          int32_t d_lo = d_prev-param.temporal_radius;
+          int32_t d_hi = d_prev+param.temporal_radius;
+          int16_t d = computeMatchingDisparity(u,v,I1_desc,I2_desc,false,d_lo,d_hi);
+          if (d>=0) {
+            int16_t d2 = computeMatchingDisparity(u-d,v,I1_desc,I2_desc,true,d-param.temporal_radius,d+param.temporal_radius);
+            if (d2>=0 && abs(d-d2)<=param.lr_threshold) {
+              *(D_can+getAddressOffsetImage(u_can,v_can,D_can_width)) = d;
+              continue;
+            }
+          }
+        }
+      }
+      
+      // 由粗到精：在降采样图像上做全范围匹配，再在全分辨率下只搜索其附近的窗口
+      // （左→右匹配与右→左验证的唯一性检验都在全分辨率下进行）
+      if (pyramid) {
+        int16_t d_coarse = computeMatchingDisparity(u/2,v/2,I1_desc_pyr,I2_desc_pyr,false,0,32767,true);
+        if (d_coarse<0)
+          continue;
+        int16_t d = computeMatchingDisparity(u,v,I1_desc,I2_desc,false,2*d_coarse-radius,2*d_coarse+radius);
+        if (d>=0) {
+          int16_t d2 = computeMatchingDisparity(u-d,v,I1_desc,I2_desc,true,d-radius,d+radius);
+          if (d2>=0 && abs(d-d2)<=param.lr_threshold)
+            *(D_can+getAddressOffsetImage(u_can,v_can,D_can_width)) = d;
+        }
+        continue;
+      }
+      
       // 先在左→右方向上匹配
-      d = computeMatchingDisparity(u,v,I1_desc,I2_desc,false);
+      int16_t d = computeMatchingDisparity(u,v,I1_desc,I2_desc,false);
       if (d>=0) {
         
         // 再在右→左方向验证匹配
-        d2 = computeMatchingDisparity(u-d,v,I1_desc,I2_desc,true);
+        int16_t d2 = computeMatchingDisparity(u-d,v,I1_desc,I2_desc,true);
         if (d2>=0 && abs(d-d2)<=param.lr_threshold)
           *(D_can+getAddressOffsetImage(u_can,v_can,D_can_width)) = d;
       }
     }
+  };
+  
+  // 整幅描述子：各候选行分给多个线程（按原子计数器动态领取）
+  if (param.band_height<=0) {
+    pool.run(param.num_threads,D_can_height-1,[&](int32_t j) {
+      match_row(j+1,1,D_can_width,I1_desc,I2_desc);
+    });
+    
+  // 条带流式处理：逐行计算该候选行及其上下 2 行（匹配窗口所需）的描述子，
+  // 再把这一行的候选点分段交给多个线程
+  } else {
+    int32_t num_chunks = param.num_threads>1 ? param.num_threads*4 : 1;
+    int32_t chunk      = (D_can_width-1+num_chunks-1)/num_chunks;
+    for (int32_t v_can=1; v_can<D_can_height; v_can++) {
+      int32_t v = v_can*D_candidate_stepsize;
+      computeDescriptorBand(max(v-2,0),min(v+3,height),I1_desc,I2_desc);
+      pool.run(param.num_threads,num_chunks,[&](int32_t j) {
+        match_row(v_can,1+j*chunk,min(1+(j+1)*chunk,D_can_width),I1_desc,I2_desc);
+      });
+    }
   }
   
+  // 保存本帧通过左右验证的候选视差，供下一帧预热（在剔除不一致与冗余点之前，
+  // 被剔除的点在下一帧仍然可以作为搜索窗口的中心）
+  if (param.temporal_support) {
+    memcpy(D_can_prev,D_can,D_can_width*D_can_height*sizeof(int16_t));
+    D_can_prev_valid = true;
+  }
+  
+  // 以下两步在 D_can 上原地修改，结果与遍历顺序有关，因此保持单线程顺序执行
   // 移除不一致的支持点
   removeInconsistentSupportPoints(D_can,D_can_width,D_can_height);
   
@@ -419,7 +848,7 @@ vector<Elas::support_pt> Elas::computeSupportMatches (uint8_t* I1_desc,uint8_t*
   removeRedundantSupportPoints(D_can,D_can_width,D_can_height,5,1,false);
   
   // 将图像坐标中的支持点转换为向量表示
-  vector<support_pt> p_support;
+  p_support.clear();
   for (int32_t u_can=1; u_can<D_can_width; u_can++)
     for (int32_t v_can=1; v_can<D_can_height; v_can++)
       if (*(D_can+getAddressOffsetImage(u_can,v_can,D_can_width))>=0)
@@ -431,23 +860,79 @@ vector<Elas::support_pt> Elas::computeSupportMatches (uint8_t* I1_desc,uint8_t*
   // 其视差取自最近的已有支持点
   if (param.add_corners)
     addCornerSupportPoints(p_support);
+}
 
-  // 释放临时内存
-  free(D_can);
+void Elas::computeDescriptorBand (int32_t v_begin,int32_t v_end,uint8_t* &I1_desc,uint8_t* &I2_desc) {
+  pool.invoke(param.parallel_left_right,
+    [&]() { desc1.computeRows(I1_src,v_begin,v_end); },
+    [&]() { desc2.computeRows(I2_src,v_begin,v_end); });
+  
+  // 条带的第一行存放在 I_desc 开头，减去其偏移后即可直接使用整幅图像的行号寻址
+  I1_desc = desc1.I_desc-descLineOffset(v_begin);
+  I2_desc = desc2.I_desc-descLineOffset(v_begin);
+}
+
+void Elas::updateDisparityRange (const vector<support_pt> &p_support) {
+  
+  // 本帧支持点（含角点）的视差范围：稠密匹配的候选视差只来自支持点附近的网格候选
+  // 以及三角形平面先验的邻域，因此超出此范围（加上平面先验半径）的视差不会被选中
+  int32_t d_min = param.disp_max;
+  int32_t d_max = 0;
+  for (int32_t i=0; i<p_support.size(); i++) {
+    d_min = min(d_min,(int32_t)p_support[i].d);
+    d_max = max(d_max,(int32_t)p_support[i].d);
+  }
   
-  // 返回支持点向量
-  return p_support; 
+  // 连续视频帧时取最近 auto_disp_frames 帧的并集，避免范围逐帧跳动
+  int32_t num_frames = (int32_t)disp_range_history.size();
+  disp_range_history[disp_range_next] = make_pair(d_min,d_max);
+  disp_range_next  = (disp_range_next+1)%num_frames;
+  disp_range_count = min(disp_range_count+1,num_frames);
+  for (int32_t i=0; i<disp_range_count; i++) {
+    d_min = min(d_min,disp_range_history[i].first);
+    d_max = max(d_max,disp_range_history[i].second);
+  }
+  
+  // 向两侧扩展平面先验半径与额外余量，并据此设置视差网格尺寸
+  int32_t plane_radius = (int32_t)max((float)ceil(param.sigma*param.sradius),(float)2.0);
+  int32_t margin       = plane_radius+max(param.auto_disp_margin,0);
+  disp_lo      = max(d_min-margin,0);
+  disp_hi      = min(d_max+margin,param.disp_max);
+  grid_dims[0] = disp_hi-disp_lo+2;
+  grid_blocks  = (disp_hi-disp_lo+128)/128;
 }
 
-vector<Elas::triangle> Elas::computeDelaunayTriangulation (vector<support_pt> p_support,int32_t right_image) {
+void Elas::computePyramidLevel (const uint8_t* I,uint8_t* I_pyr,Descriptor &desc) {
+  filter::downsample2x2(I,I_pyr,width,height,bpl,pyr_bpl);
+  desc.compute(I_pyr,pyr_width,pyr_height,pyr_bpl,false,desc_size);
+}
+
+void Elas::computeDelaunayTriangulation (const vector<support_pt> &p_support,int32_t right_image,vector<triangle> &tri) {
+
+  // 网格支持点的整数 Delaunay 三角剖分（不经过 Triangle 库）
+  if (param.lattice_triangulation) {
+    vector<int32_t> &points = lattice_points[right_image];
+    vector<int32_t> &tris   = lattice_tris[right_image];
+    points.resize(p_support.size()*2);
+    for (int32_t i=0; i<p_support.size(); i++) {
+      points[2*i+0] = right_image ? p_support[i].u-p_support[i].d : p_support[i].u;
+      points[2*i+1] = p_support[i].v;
+    }
+    delaunay[right_image].triangulate(points.empty() ? 0 : &points[0],p_support.size(),tris);
+    tri.clear();
+    for (size_t i=0; i<tris.size(); i+=3)
+      tri.push_back(triangle(tris[i],tris[i+1],tris[i+2]));
+    return;
+  }
 
   // 三角剖分的输入 / 输出结构体
   struct triangulateio in, out;
   int32_t k;
 
-  // 输入部分
+  // 输入部分（点坐标缓冲区在多帧之间复用，左右图各一个）
   in.numberofpoints = p_support.size();
-  in.pointlist = (float*)malloc(in.numberofpoints*2*sizeof(float));
+  tri_points[right_image].resize(in.numberofpoints*2);
+  in.pointlist = &tri_points[right_image][0];
   k=0;
   if (!right_image) {
     for (int32_t i=0; i<p_support.size(); i++) {
@@ -485,7 +970,7 @@ vector<Elas::triangle> Elas::computeDelaunayTriangulation (vector<support_pt> p_
   triangulate(parameters, &in, &out, NULL);
   
   // 将三角形结果写入 tri 向量
-  vector<triangle> tri;
+  tri.clear();
   k=0;
   for (int32_t i=0; i<out.numberoftriangles; i++) {
     tri.push_back(triangle(out.trianglelist[k],out.trianglelist[k+1],out.trianglelist[k+2]));
@@ -493,95 +978,96 @@ vector<Elas::triangle> Elas::computeDelaunayTriangulation (vector<support_pt> p_
   }
   
   // 释放三角剖分过程中申请的内存
-  free(in.pointlist);
   free(out.pointlist);
   free(out.trianglelist);
-  
-  // 返回三角形列表
-  return tri;
 }
 
-void Elas::computeDisparityPlanes (vector<support_pt> p_support,vector<triangle> &tri,int32_t right_image) {
+// 32 位整数末尾 0 的个数（x 不能为 0）
+static inline int32_t countTrailingZeros (uint32_t x) {
+#ifdef _MSC_VER
+  unsigned long i;
+  _BitScanForward(&i,x);
+  return i;
+#else
+  return __builtin_ctz(x);
+#endif
+}
 
-  // 初始化线性方程组所需的矩阵
-  Matrix A(3,3);
-  Matrix b(3,1);
+// 用克莱姆法则同时求解 2 个三角形的视差平面 d = a*u+b*v+c（SSE2 双精度）。
+// 顶点坐标先平移到第一个顶点，行列式与分子都是精确的整数，结果与原来的
+// Matrix::solve 逐位一致；三点共线（行列式为 0）时平面参数置为 0，与 solve 失败时相同。
+static inline void solvePlanes2 (const __m128d *u,const __m128d *v,const __m128d *d,__m128d &a,__m128d &b,__m128d &c) {
+  __m128d du2 = _mm_sub_pd(u[1],u[0]), du3 = _mm_sub_pd(u[2],u[0]);
+  __m128d dv2 = _mm_sub_pd(v[1],v[0]), dv3 = _mm_sub_pd(v[2],v[0]);
+  __m128d dd2 = _mm_sub_pd(d[1],d[0]), dd3 = _mm_sub_pd(d[2],d[0]);
+  __m128d det   = _mm_sub_pd(_mm_mul_pd(du2,dv3),_mm_mul_pd(du3,dv2));
+  __m128d valid = _mm_cmpneq_pd(det,_mm_setzero_pd());
+  a = _mm_div_pd(_mm_sub_pd(_mm_mul_pd(dd2,dv3),_mm_mul_pd(dd3,dv2)),det);
+  b = _mm_div_pd(_mm_sub_pd(_mm_mul_pd(du2,dd3),_mm_mul_pd(du3,dd2)),det);
+  a = _mm_and_pd(a,valid);
+  b = _mm_and_pd(b,valid);
+  c = _mm_sub_pd(_mm_sub_pd(d[0],_mm_mul_pd(a,u[0])),_mm_mul_pd(b,v[0]));
+  c = _mm_and_pd(c,valid);
+}
+
+void Elas::computeDisparityPlanes (const vector<support_pt> &p_support,vector<triangle> &tri,int32_t right_image) {
+
+  // 顶点坐标（左图 u、右图 u-d）与平面参数，每个寄存器保存 2 个三角形
+  __m128d xu1[3],xu2[3],xv[3],xd[3];
+  __m128d xa,xb,xc;
   
-  // 对每个三角形计算其对应的视差平面
-  for (int32_t i=0; i<tri.size(); i++) {
-    
-    // 取得三角形三个顶点在支持点向量中的索引
-    int32_t c1 = tri[i].c1;
-    int32_t c2 = tri[i].c2;
-    int32_t c3 = tri[i].c3;
-    
-    // 构建左图三角形对应线性系统的系数矩阵 A
-    A.val[0][0] = p_support[c1].u;
-    A.val[1][0] = p_support[c2].u;
-    A.val[2][0] = p_support[c3].u;
-    A.val[0][1] = p_support[c1].v; A.val[0][2] = 1;
-    A.val[1][1] = p_support[c2].v; A.val[1][2] = 1;
-    A.val[2][1] = p_support[c3].v; A.val[2][2] = 1;
+  // 每次对 2 个三角形计算其对应的视差平面
+  int32_t num_tri = tri.size();
+  for (int32_t i=0; i<num_tri; i+=2) {
     
-    // 构建右端向量 b（包含三个顶点的视差）
-    b.val[0][0] = p_support[c1].d;
-    b.val[1][0] = p_support[c2].d;
-    b.val[2][0] = p_support[c3].d;
-    
-    // 若高斯-约旦消元成功
-    if (b.solve(A)) {
-      
-      // 从 b 中读取平面参数
-      tri[i].t1a = b.val[0][0];
-      tri[i].t1b = b.val[1][0];
-      tri[i].t1c = b.val[2][0];
-      
-    // 否则标记为无效平面
-    } else {
-      tri[i].t1a = 0;
-      tri[i].t1b = 0;
-      tri[i].t1c = 0;
+    // 收集顶点坐标，最后只剩 1 个三角形时两个通道使用同一个三角形
+    const triangle &t0 = tri[i];
+    const triangle &t1 = tri[i+1<num_tri ? i+1 : i];
+    const support_pt *p0[3] = {&p_support[t0.c1],&p_support[t0.c2],&p_support[t0.c3]};
+    const support_pt *p1[3] = {&p_support[t1.c1],&p_support[t1.c2],&p_support[t1.c3]};
+    for (int32_t j=0; j<3; j++) {
+      xu1[j] = _mm_set_pd(p1[j]->u,p0[j]->u);
+      xu2[j] = _mm_set_pd(p1[j]->u-p1[j]->d,p0[j]->u-p0[j]->d);
+      xv[j]  = _mm_set_pd(p1[j]->v,p0[j]->v);
+      xd[j]  = _mm_set_pd(p1[j]->d,p0[j]->d);
     }
-
-    // 为右图中的对应三角形重新构建系数矩阵 A
-    A.val[0][0] = p_support[c1].u-p_support[c1].d;
-    A.val[1][0] = p_support[c2].u-p_support[c2].d;
-    A.val[2][0] = p_support[c3].u-p_support[c3].d;
-    A.val[0][1] = p_support[c1].v; A.val[0][2] = 1;
-    A.val[1][1] = p_support[c2].v; A.val[1][2] = 1;
-    A.val[2][1] = p_support[c3].v; A.val[2][2] = 1;
     
-    // 构建右图线性系统的右端向量 b（包含三个顶点的视差）
-    b.val[0][0] = p_support[c1].d;
-    b.val[1][0] = p_support[c2].d;
-    b.val[2][0] = p_support[c3].d;
+    // 左图平面
+    solvePlanes2(xu1,xv,xd,xa,xb,xc);
+    tri[i].t1a = _mm_cvtsd_f64(xa);
+    tri[i].t1b = _mm_cvtsd_f64(xb);
+    tri[i].t1c = _mm_cvtsd_f64(xc);
+    if (i+1<num_tri) {
+      tri[i+1].t1a = _mm_cvtsd_f64(_mm_unpackhi_pd(xa,xa));
+      tri[i+1].t1b = _mm_cvtsd_f64(_mm_unpackhi_pd(xb,xb));
+      tri[i+1].t1c = _mm_cvtsd_f64(_mm_unpackhi_pd(xc,xc));
+    }
     
-    // 若高斯-约旦消元成功
-    if (b.solve(A)) {
-      
-      // 从 b 中读取右图平面参数
-      tri[i].t2a = b.val[0][0];
-      tri[i].t2b = b.val[1][0];
-      tri[i].t2c = b.val[2][0];
-      
-    // 否则标记为无效平面
-    } else {
-      tri[i].t2a = 0;
-      tri[i].t2b = 0;
-      tri[i].t2c = 0;
+    // 右图平面
+    solvePlanes2(xu2,xv,xd,xa,xb,xc);
+    tri[i].t2a = _mm_cvtsd_f64(xa);
+    tri[i].t2b = _mm_cvtsd_f64(xb);
+    tri[i].t2c = _mm_cvtsd_f64(xc);
+    if (i+1<num_tri) {
+      tri[i+1].t2a = _mm_cvtsd_f64(_mm_unpackhi_pd(xa,xa));
+      tri[i+1].t2b = _mm_cvtsd_f64(_mm_unpackhi_pd(xb,xb));
+      tri[i+1].t2c = _mm_cvtsd_f64(_mm_unpackhi_pd(xc,xc));
     }
-  }  
+  }
 }
 
-void Elas::createGrid(vector<support_pt> p_support,int32_t* disparity_grid,int32_t* grid_dims,bool right_image) {
+void Elas::createGrid(const vector<support_pt> &p_support,uint16_t* disparity_grid,int32_t* grid_dims,bool right_image) {
   
   // 获取视差网格的尺寸
   int32_t grid_width  = grid_dims[1];
   int32_t grid_height = grid_dims[2];
   
-  // 为辅助网格分配临时内存
-  int32_t* temp1 = (int32_t*)calloc((param.disp_max+1)*grid_height*grid_width,sizeof(int32_t));
-  int32_t* temp2 = (int32_t*)calloc((param.disp_max+1)*grid_height*grid_width,sizeof(int32_t));
+  // 清空辅助位图网格（内存由 reserve 按整个视差范围分配）：每个单元用 grid_blocks 个
+  // 128 位块记录 disp_lo..disp_hi 中哪些视差被标记（第 d-disp_lo 位）
+  __m128i* temp1 = grid_temp1[param.parallel_left_right && right_image];
+  __m128i* temp2 = grid_temp2[param.parallel_left_right && right_image];
+  memset(temp1,0,grid_blocks*grid_height*grid_width*sizeof(__m128i));
+  memset(temp2,0,grid_blocks*grid_height*grid_width*sizeof(__m128i));
   
   // 遍历所有支持点
   for (int32_t i=0; i<p_support.size(); i++) {
@@ -590,74 +1076,71 @@ void Elas::createGrid(vector<support_pt> p_support,int32_t* disparity_grid,int32
     int32_t x_curr = p_support[i].u;
     int32_t y_curr = p_support[i].v;
     int32_t d_curr = p_support[i].d;
-    int32_t d_min  = max(d_curr-1,0);
-    int32_t d_max  = min(d_curr+1,param.disp_max);
+    int32_t d_min  = max(d_curr-1,disp_lo);
+    int32_t d_max  = min(d_curr+1,disp_hi);
     
     // 在临时网格 temp1 中标记该支持点影响到的视差位置
-    for (int32_t d=d_min; d<=d_max; d++) {
-      int32_t x;
-      if (!right_image)
-        x = floor((float)(x_curr/param.grid_size));
-      else
-        x = floor((float)(x_curr-d_curr)/(float)param.grid_size);
-      int32_t y = floor((float)y_curr/(float)param.grid_size);
+    int32_t x;
+    if (!right_image)
+      x = floor((float)(x_curr/param.grid_size));
+    else
+      x = floor((float)(x_curr-d_curr)/(float)param.grid_size);
+    int32_t y = floor((float)y_curr/(float)param.grid_size);
       
-      // 角点等情况可能会落在网格边界之外
-      if (x>=0 && x<grid_width &&y>=0 && y<grid_height) {
-        int32_t addr = getAddressOffsetGrid(x,y,d,grid_width,param.disp_max+1);
-        *(temp1+addr) = 1;
-      }
+    // 角点等情况可能会落在网格边界之外
+    if (x>=0 && x<grid_width &&y>=0 && y<grid_height) {
+      uint32_t* bits = (uint32_t*)(temp1+(y*grid_width+x)*grid_blocks);
+      for (int32_t d=d_min-disp_lo; d<=d_max-disp_lo; d++)
+        bits[d>>5] |= 1u<<(d&31);
     }
   }
   
-  // 扩散操作的指针
-  const int32_t* tl = temp1 + (0*grid_width+0)*(param.disp_max+1);
-  const int32_t* tc = temp1 + (0*grid_width+1)*(param.disp_max+1);
-  const int32_t* tr = temp1 + (0*grid_width+2)*(param.disp_max+1);
-  const int32_t* cl = temp1 + (1*grid_width+0)*(param.disp_max+1);
-  const int32_t* cc = temp1 + (1*grid_width+1)*(param.disp_max+1);
-  const int32_t* cr = temp1 + (1*grid_width+2)*(param.disp_max+1);
-  const int32_t* bl = temp1 + (2*grid_width+0)*(param.disp_max+1);
-  const int32_t* bc = temp1 + (2*grid_width+1)*(param.disp_max+1);
-  const int32_t* br = temp1 + (2*grid_width+2)*(param.disp_max+1);
+  // 扩散操作的指针（按整个 128 位块进行 3×3 邻域"或"运算）
+  const __m128i* tl = temp1 + (0*grid_width+0)*grid_blocks;
+  const __m128i* tc = temp1 + (0*grid_width+1)*grid_blocks;
+  const __m128i* tr = temp1 + (0*grid_width+2)*grid_blocks;
+  const __m128i* cl = temp1 + (1*grid_width+0)*grid_blocks;
+  const __m128i* cc = temp1 + (1*grid_width+1)*grid_blocks;
+  const __m128i* cr = temp1 + (1*grid_width+2)*grid_blocks;
+  const __m128i* bl = temp1 + (2*grid_width+0)*grid_blocks;
+  const __m128i* bc = temp1 + (2*grid_width+1)*grid_blocks;
+  const __m128i* br = temp1 + (2*grid_width+2)*grid_blocks;
   
-  int32_t* result    = temp2 + (1*grid_width+1)*(param.disp_max+1); 
-  int32_t* end_input = temp1 + grid_width*grid_height*(param.disp_max+1);
+  __m128i* result          = temp2 + (1*grid_width+1)*grid_blocks;
+  const __m128i* end_input = temp1 + grid_width*grid_height*grid_blocks;
   
   // 对临时网格进行 3×3 邻域扩散
-  for( ; br != end_input; tl++, tc++, tr++, cl++, cc++, cr++, bl++, bc++, br++, result++ )
-    *result = *tl | *tc | *tr | *cl | *cc | *cr | *bl | *bc | *br;
+  for( ; br < end_input; tl++, tc++, tr++, cl++, cc++, cr++, bl++, bc++, br++, result++ ) {
+    __m128i xmm = _mm_or_si128(_mm_or_si128(_mm_or_si128(*tl,*tc),_mm_or_si128(*tr,*cl)),
+                               _mm_or_si128(_mm_or_si128(*cc,*cr),_mm_or_si128(*bl,*bc)));
+    *result = _mm_or_si128(xmm,*br);
+  }
   
   // 遍历所有网格单元，生成最终的视差候选列表
-  for (int32_t x=0; x<grid_width; x++) {
-    for (int32_t y=0; y<grid_height; y++) {
-        
+  for (int32_t y=0; y<grid_height; y++) {
+    for (int32_t x=0; x<grid_width; x++) {
+      
       // 从索引 1 开始，索引 0 保留用于存储视差数量
+      uint16_t* cell = disparity_grid+getAddressOffsetGrid(x,y,0,grid_width,grid_dims[0]);
       int32_t curr_ind = 1;
       
-      // 遍历全部可能的视差
-      for (int32_t d=0; d<=param.disp_max; d++) {
-
-        // 若该视差在扩散后的临时网格中被标记，则加入当前网格单元
-        if (*(temp2+getAddressOffsetGrid(x,y,d,grid_width,param.disp_max+1))>0) {
-          *(disparity_grid+getAddressOffsetGrid(x,y,curr_ind,grid_width,param.disp_max+2))=d;
-          curr_ind++;
-        }
+      // 按升序取出扩散后位图中被标记的视差
+      const uint32_t* bits = (const uint32_t*)(temp2+(y*grid_width+x)*grid_blocks);
+      for (int32_t w=0; w<grid_blocks*4; w++) {
+        for (uint32_t word=bits[w]; word; word&=word-1)
+          cell[curr_ind++] = disp_lo+32*w+countTrailingZeros(word);
       }
       
       // 最后在索引 0 处写入当前单元中的视差数量
-      *(disparity_grid+getAddressOffsetGrid(x,y,0,grid_width,param.disp_max+2))=curr_ind-1;
+      cell[0] = curr_ind-1;
     }
   }
   
-  // 释放临时网格内存
-  free(temp1);
-  free(temp2);
 }
 
-inline void Elas::updatePosteriorMinimum(__m128i* I2_block_addr,const int32_t &d,const int32_t &w,
+inline void Elas::updatePosteriorMinimum(const uint8_t* I2_block_addr,const int32_t &d,const int32_t &w,
                                          const __m128i &xmm1,__m128i &xmm2,int32_t &val,int32_t &min_val,int32_t &min_d) {
-  xmm2 = _mm_load_si128(I2_block_addr);
+  xmm2 = loadDescriptor(I2_block_addr);
   xmm2 = _mm_sad_epu8(xmm1,xmm2);
   val  = _mm_extract_epi16(xmm2,0)+_mm_extract_epi16(xmm2,4)+w;
   if (val<min_val) {
@@ -666,9 +1149,9 @@ inline void Elas::updatePosteriorMinimum(__m128i* I2_block_addr,const int32_t &d
   }
 }
 
-inline void Elas::updatePosteriorMinimum(__m128i* I2_block_addr,const int32_t &d,
+inline void Elas::updatePosteriorMinimum(const uint8_t* I2_block_addr,const int32_t &d,
                                          const __m128i &xmm1,__m128i &xmm2,int32_t &val,int32_t &min_val,int32_t &min_d) {
-  xmm2 = _mm_load_si128(I2_block_addr);
+  xmm2 = loadDescriptor(I2_block_addr);
   xmm2 = _mm_sad_epu8(xmm1,xmm2);
   val  = _mm_extract_epi16(xmm2,0)+_mm_extract_epi16(xmm2,4);
   if (val<min_val) {
@@ -678,11 +1161,10 @@ inline void Elas::updatePosteriorMinimum(__m128i* I2_block_addr,const int32_t &d
 }
 
 inline void Elas::findMatch(int32_t &u,int32_t &v,float &plane_a,float &plane_b,float &plane_c,
-                            int32_t* disparity_grid,int32_t *grid_dims,uint8_t* I1_desc,uint8_t* I2_desc,
+                            uint16_t* disparity_grid,int32_t *grid_dims,uint8_t* I1_desc,uint8_t* I2_desc,
                             int32_t *P,int32_t &plane_radius,bool &valid,bool &right_image,float* D){
   
-  // 获取与视差计算相关的参数（视差个数与窗口尺寸）
-  const int32_t disp_num    = grid_dims[0]-1;
+  // 匹配窗口尺寸
   const int32_t window_size = 2;
 
   // 目标视差在视差图中的地址
@@ -694,8 +1176,9 @@ inline void Elas::findMatch(int32_t &u,int32_t &v,float &plane_a,float &plane_b,
   if (u<window_size || u>=width-window_size)
     return;
 
-  // 计算当前行在描述子缓冲中的起始偏移
-  int32_t  line_offset = 16*width*max(min(v,height-3),2);
+  // 计算当前行在描述子缓冲中的起始偏移。半分辨率模式下 v 总是偶数，
+  // 边界处的行未被写入、内容全为零，与全分辨率模式下截断到的边界行相同
+  int32_t  line_offset = param.subsampling ? descLineOffset(v) : descLineOffset(max(min(v,height-3),2));
   uint8_t *I1_line_addr,*I2_line_addr;
   if (!right_image) {
     I1_line_addr = I1_desc+line_offset;
@@ -706,50 +1189,75 @@ inline void Elas::findMatch(int32_t &u,int32_t &v,float &plane_a,float &plane_b,
   }
 
   // 计算 I1 中当前块的起始地址
-  uint8_t* I1_block_addr = I1_line_addr+16*u;
+  uint8_t* I1_block_addr = I1_line_addr+desc_size*u;
   
   // 检查该块是否具有足够的纹理
-  int32_t sum = 0;
-  for (int32_t i=0; i<16; i++)
-    sum += abs((int32_t)(*(I1_block_addr+i))-128);
+  int32_t sum = descriptorTexture(I1_block_addr);
   if (sum<param.match_texture)
     return;
 
   // 根据当前平面先验计算视差、最小视差和最大视差
   int32_t d_plane     = (int32_t)(plane_a*(float)u+plane_b*(float)v+plane_c);
-  int32_t d_plane_min = max(d_plane-plane_radius,0);
-  int32_t d_plane_max = min(d_plane+plane_radius,disp_num-1);
+  int32_t d_plane_min = max(d_plane-plane_radius,disp_lo);
+  int32_t d_plane_max = min(d_plane+plane_radius,disp_hi);
 
   // 获取当前像素所在网格单元及其视差候选列表
   int32_t  grid_x    = (int32_t)floor((float)u/(float)param.grid_size);
   int32_t  grid_y    = (int32_t)floor((float)v/(float)param.grid_size);
   uint32_t grid_addr = getAddressOffsetGrid(grid_x,grid_y,0,grid_dims[1],grid_dims[0]);  
-  int32_t  num_grid  = *(disparity_grid+grid_addr);
-  int32_t* d_grid    = disparity_grid+grid_addr+1;
+  int32_t   num_grid = *(disparity_grid+grid_addr);
+  uint16_t* d_grid   = disparity_grid+grid_addr+1;
   
   // 循环变量
   int32_t d_curr, u_warp, val;
   int32_t min_val = 10000;
   int32_t min_d   = -1;
-  __m128i xmm1    = _mm_load_si128((__m128i*)I1_block_addr);
+  __m128i xmm1    = loadDescriptor(I1_block_addr);
   __m128i xmm2;
 
+  // AVX2：先按原有顺序收集候选（每批最多 64 个），再成对计算代价并在向量寄存器中求最小值
+  if (use_avx2) {
+    const int32_t batch = 64;
+    int32_t offset[batch],weight[batch],disp[batch];
+    int32_t num  = 0;
+    int32_t sign = right_image ? +1 : -1;
+    auto push = [&](int32_t d,int32_t w) {
+      u_warp = u+sign*d;
+      if (u_warp<window_size || u_warp>=width-window_size)
+        return;
+      offset[num] = desc_size*u_warp;
+      weight[num] = w;
+      disp[num]   = d;
+      if (++num==batch) {
+        simd::posteriorMinimumAVX2(I1_block_addr,I2_line_addr,offset,weight,disp,num,desc_size,min_val,min_d);
+        num = 0;
+      }
+    };
+    for (int32_t i=0; i<num_grid; i++) {
+      d_curr = d_grid[i];
+      if (d_curr<d_plane_min || d_curr>d_plane_max)
+        push(d_curr,0);
+    }
+    for (d_curr=d_plane_min; d_curr<=d_plane_max; d_curr++)
+      push(d_curr,valid?*(P+abs(d_curr-d_plane)):0);
+    simd::posteriorMinimumAVX2(I1_block_addr,I2_line_addr,offset,weight,disp,num,desc_size,min_val,min_d);
+    
   // 左图
-  if (!right_image) { 
+  } else if (!right_image) { 
     for (int32_t i=0; i<num_grid; i++) {
       d_curr = d_grid[i];
       if (d_curr<d_plane_min || d_curr>d_plane_max) {
         u_warp = u-d_curr;
         if (u_warp<window_size || u_warp>=width-window_size)
           continue;
-        updatePosteriorMinimum((__m128i*)(I2_line_addr+16*u_warp),d_curr,xmm1,xmm2,val,min_val,min_d);
+        updatePosteriorMinimum(I2_line_addr+desc_size*u_warp,d_curr,xmm1,xmm2,val,min_val,min_d);
       }
     }
     for (d_curr=d_plane_min; d_curr<=d_plane_max; d_curr++) {
       u_warp = u-d_curr;
       if (u_warp<window_size || u_warp>=width-window_size)
         continue;
-      updatePosteriorMinimum((__m128i*)(I2_line_addr+16*u_warp),d_curr,valid?*(P+abs(d_curr-d_plane)):0,xmm1,xmm2,val,min_val,min_d);
+      updatePosteriorMinimum(I2_line_addr+desc_size*u_warp,d_curr,valid?*(P+abs(d_curr-d_plane)):0,xmm1,xmm2,val,min_val,min_d);
     }
     
   // 右图
@@ -760,14 +1268,14 @@ inline void Elas::findMatch(int32_t &u,int32_t &v,float &plane_a,float &plane_b,
         u_warp = u+d_curr;
         if (u_warp<window_size || u_warp>=width-window_size)
           continue;
-        updatePosteriorMinimum((__m128i*)(I2_line_addr+16*u_warp),d_curr,xmm1,xmm2,val,min_val,min_d);
+        updatePosteriorMinimum(I2_line_addr+desc_size*u_warp,d_curr,xmm1,xmm2,val,min_val,min_d);
       }
     }
     for (d_curr=d_plane_min; d_curr<=d_plane_max; d_curr++) {
       u_warp = u+d_curr;
       if (u_warp<window_size || u_warp>=width-window_size)
         continue;
-      updatePosteriorMinimum((__m128i*)(I2_line_addr+16*u_warp),d_curr,valid?*(P+abs(d_curr-d_plane)):0,xmm1,xmm2,val,min_val,min_d);
+      updatePosteriorMinimum(I2_line_addr+desc_size*u_warp,d_curr,valid?*(P+abs(d_curr-d_plane)):0,xmm1,xmm2,val,min_val,min_d);
     }
   }
 
@@ -776,30 +1284,124 @@ inline void Elas::findMatch(int32_t &u,int32_t &v,float &plane_a,float &plane_b,
   else          *(D+d_addr) = -1;    // 视为无效视差
 }
 
-// TODO: 以更优雅的方式处理 %2 这样的运算
-void Elas::computeDisparity(vector<support_pt> p_support,vector<triangle> tri,int32_t* disparity_grid,int32_t *grid_dims,
-                            uint8_t* I1_desc,uint8_t* I2_desc,bool right_image,float* D) {
+// 在三角形编号图中记录覆盖像素 (u,v) 的三角形；与 findMatch 一样跳过左右边界，
+// 这些像素在逐三角形模式下也不会被写入
+inline void Elas::markTriangle (const int32_t &u,const int32_t &v,const int32_t &i,int32_t* tri_index) {
+  const int32_t window_size = 2;
+  if (u<window_size || u>=width-window_size)
+    return;
+  if (param.subsampling) {
+    if (v/2<height/2)
+      *(tri_index+getAddressOffsetImage(u/2,v/2,width/2)) = i;
+  } else {
+    *(tri_index+getAddressOffsetImage(u,v,width)) = i;
+  }
+}
 
-  // 视差数
-  const int32_t disp_num  = grid_dims[0]-1;
-  
-  // 描述子窗口大小
-  int32_t window_size = 2;
-  
-  // 将视差图初始化为 -10（表示尚未赋值的状态）
+void Elas::computeDisparity(const vector<support_pt> &p_support,const vector<triangle> &tri,uint16_t* disparity_grid,int32_t *grid_dims,
+                            uint8_t* I1_desc,uint8_t* I2_desc,bool right_image,float* D,int32_t v_begin,int32_t v_end) {
+
+  // 将第 v_begin ... v_end-1 行对应的视差图行初始化为 -10（表示尚未赋值的状态）
   if (param.subsampling) {
-    for (int32_t i=0; i<(width/2)*(height/2); i++)
+    int32_t D_v_end = min((v_end+1)/2,height/2);
+    for (int32_t i=(v_begin/2)*(width/2); i<D_v_end*(width/2); i++)
       *(D+i) = -10;
   } else {
-    for (int32_t i=0; i<width*height; i++)
+    for (int32_t i=v_begin*width; i<v_end*width; i++)
       *(D+i) = -10;
   }
   
-  // 预先计算视差差的先验代价
-  float two_sigma_squared = 2*param.sigma*param.sigma;
-  int32_t* P = new int32_t[disp_num];
-  for (int32_t delta_d=0; delta_d<disp_num; delta_d++)
-    P[delta_d] = (int32_t)((-log(param.gamma+exp(-delta_d*delta_d/two_sigma_squared))+log(param.gamma))/param.beta);
+  // 处理 [v_begin,v_end) 行：逐三角形光栅化并匹配，或先记录三角形编号再逐行匹配
+  auto rows = [&](int32_t v_begin,int32_t v_end) {
+    if (param.scanline_matching)
+      computeDisparityScanline(p_support,tri,disparity_grid,grid_dims,I1_desc,I2_desc,right_image,D,v_begin,v_end);
+    else
+      computeDisparityRows(p_support,tri,disparity_grid,grid_dims,I1_desc,I2_desc,right_image,D,v_begin,v_end,0);
+  };
+  
+  // 单线程：一次处理全部行
+  if (param.num_threads<=1) {
+    rows(v_begin,v_end);
+    return;
+  }
+  
+  // 多线程：将这些行划分为若干水平条带（行数取偶数，保证半分辨率模式下
+  // 各条带写入不同的视差图行）。每个条带按原顺序遍历全部三角形，
+  // 因此每个像素的写入顺序与单线程完全相同，结果逐位一致。
+  int32_t num_bands   = param.num_threads*4;
+  int32_t band_height = (v_end-v_begin+num_bands-1)/num_bands;
+  band_height += band_height%2;
+  num_bands = (v_end-v_begin+band_height-1)/band_height;
+  pool.run(param.num_threads,num_bands,[&](int32_t band) {
+    int32_t band_begin = v_begin+band*band_height;
+    int32_t band_end   = min(band_begin+band_height,v_end);
+    rows(band_begin,band_end);
+  });
+}
+
+// 扫描线模式：先把覆盖每个像素的最后一个三角形编号光栅化到 tri_index 中，
+// 再按行主序逐像素匹配。findMatch 是否写入只取决于像素本身，逐三角形模式下
+// 每个像素的最终视差总是来自最后一个覆盖它的三角形，因此两种模式结果逐位一致，
+// 而按行访问时描述子行与视差图行都能留在缓存中。
+void Elas::computeDisparityScanline(const vector<support_pt> &p_support,const vector<triangle> &tri,uint16_t* disparity_grid,int32_t *grid_dims,
+                                    uint8_t* I1_desc,uint8_t* I2_desc,bool right_image,float* D,int32_t v_begin,int32_t v_end) {
+
+  // 视差图尺寸与三角形编号图（内存由 reserve 分配，左右图各一份）
+  int32_t D_width  = width;
+  int32_t D_height = height;
+  int32_t D_step   = 1;
+  if (param.subsampling) {
+    D_width  = width/2;
+    D_height = height/2;
+    D_step   = 2;
+  }
+  int32_t* index = tri_index[param.parallel_left_right && right_image];
+  int32_t  D_v_begin = (v_begin+D_step-1)/D_step;
+  int32_t  D_v_end   = min((v_end+D_step-1)/D_step,D_height);
+  for (int32_t i=D_v_begin*D_width; i<D_v_end*D_width; i++)
+    *(index+i) = -1;
+  
+  // 光栅化三角形编号
+  computeDisparityRows(p_support,tri,disparity_grid,grid_dims,I1_desc,I2_desc,right_image,D,v_begin,v_end,index);
+  
+  // 视差差的先验代价表 P 已在 reserve 中预先计算
+  int32_t plane_radius = (int32_t)max((float)ceil(param.sigma*param.sradius),(float)2.0);
+  float plane_a,plane_b,plane_c,plane_d;
+  
+  // 按行主序匹配所有被三角形覆盖的像素
+  for (int32_t v_D=D_v_begin; v_D<D_v_end; v_D++) {
+    int32_t  v         = v_D*D_step;
+    int32_t* index_row = index+v_D*D_width;
+    for (int32_t u_D=0; u_D<D_width; u_D++) {
+      int32_t i = index_row[u_D];
+      if (i<0)
+        continue;
+      if (!right_image) {
+        plane_a = tri[i].t1a;
+        plane_b = tri[i].t1b;
+        plane_c = tri[i].t1c;
+        plane_d = tri[i].t2a;
+      } else {
+        plane_a = tri[i].t2a;
+        plane_b = tri[i].t2b;
+        plane_c = tri[i].t2c;
+        plane_d = tri[i].t1a;
+      }
+      bool valid = fabs(plane_a)<0.7 && fabs(plane_d)<0.7;
+      int32_t u  = u_D*D_step;
+      findMatch(u,v,plane_a,plane_b,plane_c,disparity_grid,grid_dims,
+                I1_desc,I2_desc,P,plane_radius,valid,right_image,D);
+    }
+  }
+}
+
+// TODO: 以更优雅的方式处理 %2 这样的运算
+// tri_index 非空时不做匹配，只把三角形编号写入覆盖到的像素（供扫描线模式使用）
+void Elas::computeDisparityRows(const vector<support_pt> &p_support,const vector<triangle> &tri,uint16_t* disparity_grid,int32_t *grid_dims,
+                                uint8_t* I1_desc,uint8_t* I2_desc,bool right_image,float* D,int32_t v_begin,int32_t v_end,
+                                int32_t* tri_index) {
+
+  // 视差差的先验代价表 P 已在 reserve 中预先计算
   int32_t plane_radius = (int32_t)max((float)ceil(param.sigma*param.sradius),(float)2.0);
 
   // 循环变量
@@ -841,6 +1443,12 @@ void Elas::computeDisparity(vector<support_pt> p_support,vector<triangle> tri,in
     }
     float tri_v[3] = {p_support[c1].v,p_support[c2].v,p_support[c3].v};
     
+    // 跳过与当前行范围 [v_begin,v_end) 不相交的三角形
+    float tri_v_min = min(tri_v[0],min(tri_v[1],tri_v[2]));
+    float tri_v_max = max(tri_v[0],max(tri_v[1],tri_v[2]));
+    if (tri_v_max+1<v_begin || tri_v_min-1>=v_end)
+      continue;
+    
     for (uint32_t j=0; j<3; j++) {
       for (uint32_t k=0; k<j; k++) {
         if (tri_u[k]>tri_u[j]) {
@@ -873,10 +1481,11 @@ void Elas::computeDisparity(vector<support_pt> p_support,vector<triangle> tri,in
         if (!param.subsampling || u%2==0) {
           int32_t v_1 = (uint32_t)(AC_a*(float)u+AC_b);
           int32_t v_2 = (uint32_t)(AB_a*(float)u+AB_b);
-          for (int32_t v=min(v_1,v_2); v<max(v_1,v_2); v++)
+          for (int32_t v=max(min(v_1,v_2),v_begin); v<min(max(v_1,v_2),v_end); v++)
             if (!param.subsampling || v%2==0) {
-              findMatch(u,v,plane_a,plane_b,plane_c,disparity_grid,grid_dims,
-                        I1_desc,I2_desc,P,plane_radius,valid,right_image,D);
+              if (tri_index) markTriangle(u,v,i,tri_index);
+              else findMatch(u,v,plane_a,plane_b,plane_c,disparity_grid,grid_dims,
+                             I1_desc,I2_desc,P,plane_radius,valid,right_image,D);
             }
         }
       }
@@ -888,208 +1497,241 @@ void Elas::computeDisparity(vector<support_pt> p_support,vector<triangle> tri,in
         if (!param.subsampling || u%2==0) {
           int32_t v_1 = (uint32_t)(AC_a*(float)u+AC_b);
           int32_t v_2 = (uint32_t)(BC_a*(float)u+BC_b);
-          for (int32_t v=min(v_1,v_2); v<max(v_1,v_2); v++)
+          for (int32_t v=max(min(v_1,v_2),v_begin); v<min(max(v_1,v_2),v_end); v++)
             if (!param.subsampling || v%2==0) {
-              findMatch(u,v,plane_a,plane_b,plane_c,disparity_grid,grid_dims,
-                        I1_desc,I2_desc,P,plane_radius,valid,right_image,D);
+              if (tri_index) markTriangle(u,v,i,tri_index);
+              else findMatch(u,v,plane_a,plane_b,plane_c,disparity_grid,grid_dims,
+                             I1_desc,I2_desc,P,plane_radius,valid,right_image,D);
             }
         }
       }
     }
     
   }
-
-  delete[] P;
 }
 
-void Elas::leftRightConsistencyCheck(float* D1,float* D2) {
-  
-  // 获取视差图尺寸
-  int32_t D_width  = width;
-  int32_t D_height = height;
-  if (param.subsampling) {
-    D_width  = width/2;
-    D_height = height/2;
-  }
+void Elas::leftRightConsistencyCheck(float* D1,float* D2,int32_t D_v_begin,int32_t D_v_end) {
   
-  // 复制左右视差图，供一致性检查使用
-  float* D1_copy = (float*)malloc(D_width*D_height*sizeof(float));
-  float* D2_copy = (float*)malloc(D_width*D_height*sizeof(float));
-  memcpy(D1_copy,D1,D_width*D_height*sizeof(float));
-  memcpy(D2_copy,D2,D_width*D_height*sizeof(float));
-
-  // 循环变量
-  uint32_t addr,addr_warp;
-  float    u_warp_1,u_warp_2,d1,d2;
-  
-  // 遍历所有像素
-  for (int32_t u=0; u<D_width; u++) {
-    for (int32_t v=0; v<D_height; v++) {
-      
-      // 计算 (u,v) 的地址，并读取对应的左右视差值
-      addr     = getAddressOffsetImage(u,v,D_width);
-      d1       = *(D1_copy+addr);
-      d2       = *(D2_copy+addr);
-      if (param.subsampling) {
-        u_warp_1 = (float)u-d1/2;
-        u_warp_2 = (float)u+d2/2;
-      } else {
-        u_warp_1 = (float)u-d1;
-        u_warp_2 = (float)u+d2;
-      }
-      
+  // 获取视差图宽度
+  int32_t D_width = width;
+  if (param.subsampling)
+    D_width = width/2;
+  
+  // 半分辨率时视差按原图像素计，投影到视差图坐标需要除以 2
+  const float scale     = param.subsampling ? 0.5f : 1.0f;
+  const float threshold = (float)param.lr_threshold;
+  
+  // 逐行检查：一致性只在同一行内查找对应点，因此每行只需先把该行的左右视差
+  // 复制到任务自己的行缓冲区 D1_in / D2_in（刚读过的行仍在缓存中），再按行主序写回结果
+  auto check_row = [&](int32_t v,float* D1_in,float* D2_in) {
+    float* D1_row = D1+getAddressOffsetImage(0,v,D_width);
+    float* D2_row = D2+getAddressOffsetImage(0,v,D_width);
+    memcpy(D1_in,D1_row,D_width*sizeof(float));
+    memcpy(D2_in,D2_row,D_width*sizeof(float));
+    
+    // AVX2：8 个像素一组，用 gather 读取投影位置的视差
+    int32_t u = 0;
+    if (use_avx2)
+      u = simd::lrCheckRowAVX2(D1_in,D2_in,D1_row,D2_row,D_width,scale,threshold);
+    
+    // SSE：4 个像素一组计算投影位置与有效性，投影位置的视差逐个读取
+    const __m128 zero    = _mm_setzero_ps();
+    const __m128 invalid = _mm_set1_ps(-10.0f);
+    const __m128 abs_msk = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 s       = _mm_set1_ps(scale);
+    const __m128 thr     = _mm_set1_ps(threshold);
+    const __m128 w       = _mm_set1_ps((float)D_width);
+    int32_t idx_1[4],idx_2[4];
+    for (; u+4<=D_width; u+=4) {
+      __m128 u_vec    = _mm_setr_ps((float)u,(float)(u+1),(float)(u+2),(float)(u+3));
+      __m128 d1       = _mm_loadu_ps(D1_in+u);
+      __m128 d2       = _mm_loadu_ps(D2_in+u);
+      __m128 u_warp_1 = _mm_sub_ps(u_vec,_mm_mul_ps(d1,s));
+      __m128 u_warp_2 = _mm_add_ps(u_vec,_mm_mul_ps(d2,s));
+      __m128 valid_1  = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(d1,zero),_mm_cmpge_ps(u_warp_1,zero)),_mm_cmplt_ps(u_warp_1,w));
+      __m128 valid_2  = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(d2,zero),_mm_cmpge_ps(u_warp_2,zero)),_mm_cmplt_ps(u_warp_2,w));
       
-      // 检查左视差是否有效
-      if (d1>=0 && u_warp_1>=0 && u_warp_1<D_width) {       
-                  
-        // 计算右视差图中对应的投影位置地址
-        addr_warp = getAddressOffsetImage((int32_t)u_warp_1,v,D_width);
-
-        // 若不满足左右一致性阈值，则将左视差置为无效
-        if (fabs(*(D2_copy+addr_warp)-d1)>param.lr_threshold)
-          *(D1+addr) = -10;
-        
-      // 左视差无效
-      } else
-        *(D1+addr) = -10;
+      // 无效通道的下标置 0，读取结果不会被使用
+      _mm_storeu_si128((__m128i*)idx_1,_mm_and_si128(_mm_cvttps_epi32(u_warp_1),_mm_castps_si128(valid_1)));
+      _mm_storeu_si128((__m128i*)idx_2,_mm_and_si128(_mm_cvttps_epi32(u_warp_2),_mm_castps_si128(valid_2)));
+      __m128 d2_warp = _mm_setr_ps(D2_in[idx_1[0]],D2_in[idx_1[1]],D2_in[idx_1[2]],D2_in[idx_1[3]]);
+      __m128 d1_warp = _mm_setr_ps(D1_in[idx_2[0]],D1_in[idx_2[1]],D1_in[idx_2[2]],D1_in[idx_2[3]]);
       
-      // 检查右视差是否有效
-      if (d2>=0 && u_warp_2>=0 && u_warp_2<D_width) {       
-
-        // 计算左视差图中对应的投影位置地址
-        addr_warp = getAddressOffsetImage((int32_t)u_warp_2,v,D_width);
-
-        // 若不满足左右一致性阈值，则将右视差置为无效
-        if (fabs(*(D1_copy+addr_warp)-d2)>param.lr_threshold)
-          *(D2+addr) = -10;
-        
-      // 右视差无效
-      } else
-        *(D2+addr) = -10;
+      // 不满足有效性或左右一致性阈值的视差置为无效
+      __m128 ok_1 = _mm_and_ps(valid_1,_mm_cmple_ps(_mm_and_ps(_mm_sub_ps(d2_warp,d1),abs_msk),thr));
+      __m128 ok_2 = _mm_and_ps(valid_2,_mm_cmple_ps(_mm_and_ps(_mm_sub_ps(d1_warp,d2),abs_msk),thr));
+      _mm_storeu_ps(D1_row+u,_mm_or_ps(_mm_and_ps(ok_1,d1),_mm_andnot_ps(ok_1,invalid)));
+      _mm_storeu_ps(D2_row+u,_mm_or_ps(_mm_and_ps(ok_2,d2),_mm_andnot_ps(ok_2,invalid)));
     }
-  }
-  
-  // 释放拷贝的视差图
-  free(D1_copy);
-  free(D2_copy);
+    
+    // 行尾逐像素处理
+    for (; u<D_width; u++) {
+      float d1       = D1_in[u];
+      float d2       = D2_in[u];
+      float u_warp_1 = (float)u-d1*scale;
+      float u_warp_2 = (float)u+d2*scale;
+      if (!(d1>=0 && u_warp_1>=0 && u_warp_1<D_width && fabs(D2_in[(int32_t)u_warp_1]-d1)<=threshold))
+        D1_row[u] = -10;
+      if (!(d2>=0 && u_warp_2>=0 && u_warp_2<D_width && fabs(D1_in[(int32_t)u_warp_2]-d2)<=threshold))
+        D2_row[u] = -10;
+    }
+  };
+  
+  // 各行互不依赖：行均分为至多 num_threads 个任务，每个任务至少 min_rows_per_job 行
+  // （条带流式处理时行数很少，不足 2*min_rows_per_job 行时直接在当前线程执行），
+  // 第 j 个任务使用 lr_rows 中的第 j 组行缓冲区
+  const int32_t min_rows_per_job = 16;
+  int32_t num_rows = D_v_end-D_v_begin;
+  int32_t num_jobs = max(min(param.num_threads,num_rows/min_rows_per_job),1);
+  pool.run(num_jobs,num_jobs,[&](int32_t j) {
+    float* D1_in = lr_rows+2*j*D_width;
+    float* D2_in = D1_in+D_width;
+    for (int32_t v=D_v_begin+num_rows*j/num_jobs; v<D_v_begin+num_rows*(j+1)/num_jobs; v++)
+      check_row(v,D1_in,D2_in);
+  });
 }
 
-void Elas::removeSmallSegments (float* D) {
+void Elas::removeSmallSegments (float* D,int32_t buf) {
   
-  // 获取视差图尺寸
+  // 获取视差图宽度（行数由 reserve 中的条带划分确定）
   int32_t D_width        = width;
-  int32_t D_height       = height;
   int32_t D_speckle_size = param.speckle_size;
   if (param.subsampling) {
     D_width        = width/2;
-    D_height       = height/2;
     D_speckle_size = sqrt((float)param.speckle_size)*2;
   }
   
-  // 在堆上为动态规划相关数组分配内存
-  int32_t *D_done     = (int32_t*)calloc(D_width*D_height,sizeof(int32_t));
-  int32_t *seg_list_u = (int32_t*)calloc(D_width*D_height,sizeof(int32_t));
-  int32_t *seg_list_v = (int32_t*)calloc(D_width*D_height,sizeof(int32_t));
-  int32_t seg_list_count;
-  int32_t seg_list_curr;
-  int32_t u_neighbor[4];
-  int32_t v_neighbor[4];
-  int32_t u_seg_curr;
-  int32_t v_seg_curr;
-  
-  // 循环中的一些辅助变量
-  int32_t addr_start, addr_curr, addr_neighbor;
-  
-  // 遍历所有像素
-  for (int32_t u=0; u<D_width; u++) {
-    for (int32_t v=0; v<D_height; v++) {
-      
-      // 获取当前像素（作为片段起点）的地址
-      addr_start = getAddressOffsetImage(u,v,D_width);
-                  
-      // 如果该像素尚未被处理
-      if (*(D_done+addr_start)==0) {
-                
-        // 初始化片段列表（先加入第一个像素，
-        // 并将其设置为下一个待检查的元素）
-        *(seg_list_u+0) = u;
-        *(seg_list_v+0) = v;
-        seg_list_count  = 1;
-        seg_list_curr   = 0;
-        
-        // 只要片段列表中仍有“未处理”的像素（即 seg_list_curr<seg_list_count），
-        // 就不断向其中加入与当前像素相邻且相似的像素
-        while (seg_list_curr<seg_list_count) {
-        
-          // 从片段列表中取出当前像素坐标
-          u_seg_curr = *(seg_list_u+seg_list_curr);
-          v_seg_curr = *(seg_list_v+seg_list_curr);
-          
-          // 获取当前像素在本片段中的地址
-          addr_curr = getAddressOffsetImage(u_seg_curr,v_seg_curr,D_width);
-          
-          // 填充 4-邻域像素的坐标
-          u_neighbor[0] = u_seg_curr-1; v_neighbor[0] = v_seg_curr;
-          u_neighbor[1] = u_seg_curr+1; v_neighbor[1] = v_seg_curr;
-          u_neighbor[2] = u_seg_curr;   v_neighbor[2] = v_seg_curr-1;
-          u_neighbor[3] = u_seg_curr;   v_neighbor[3] = v_seg_curr+1;
-          
-          // 遍历所有邻居
-          for (int32_t i=0; i<4; i++) {
-            
-            // 检查邻居是否在图像范围内
-            if (u_neighbor[i]>=0 && v_neighbor[i]>=0 && u_neighbor[i]<D_width && v_neighbor[i]<D_height) {
-              
-              // 获取邻居像素地址
-              addr_neighbor = getAddressOffsetImage(u_neighbor[i],v_neighbor[i],D_width);
-              
-              // 检查该邻居是否尚未加入列表且视差为有效值
-              if (*(D_done+addr_neighbor)==0 && *(D+addr_neighbor)>=0) {
-
-                // 判断该邻居像素与当前像素的视差是否足够接近
-                // （即是否属于同一小片段）
-                if (fabs(*(D+addr_curr)-*(D+addr_neighbor))<=param.speckle_sim_threshold) {
-                  
-                  // 将邻居坐标加入片段列表
-                  *(seg_list_u+seg_list_count) = u_neighbor[i];
-                  *(seg_list_v+seg_list_count) = v_neighbor[i];
-                  seg_list_count++;            
-                  
-                  // 将该邻居标记为已处理，
-                  // 否则可能会作为多个像素的邻居被重复加入列表
-                  *(D_done+addr_neighbor) = 1;
-                }
-              }
-              
-            } 
-          }
-          
-          // 当前列表元素处理完毕，移动到下一个
-          seg_list_curr++;
-          
-          // 将当前像素在 D_done 中标记为已处理
-          *(D_done+addr_curr) = 1;
-
-        } // 结束：while (seg_list_curr<seg_list_count)
-        
-        // 如果该片段的尺寸太小，则视为噪声，全部置为无效
-        if (seg_list_count<D_speckle_size) {
-          
-          // 将当前片段中的所有像素都置为无效视差
-          for (int32_t i=0; i<seg_list_count; i++) {
-            addr_curr = getAddressOffsetImage(*(seg_list_u+i),*(seg_list_v+i),D_width);
-            *(D+addr_curr) = -10;
-          }
+  // 片段由 4-邻域中视差相差不超过 speckle_sim_threshold 的有效像素连通而成，
+  // 像素数小于 D_speckle_size 的片段置为无效。无效像素各自单独成为一个片段
+  // （一致性检查之后无效视差均为 -10，与任何有效视差都不相似）。
+  // 按行扫描标记连通片段：同一行中相似的相邻有效像素组成一个行程，行程即并查集节点。
+  // 行程只记录起止列，所需内存与行程数成正比；
+  // 各条带内部独立标记（可并行），再为所有行程统一编号并合并条带边界，最后统计片段尺寸
+  vector<segment_runs> &bands = seg_runs[buf];
+  const int32_t *band_v = seg_band_v[buf].data();
+  int32_t *offset       = seg_offset[buf].data();
+  int32_t num_bands     = (int32_t)bands.size();
+  const float threshold = param.speckle_sim_threshold;
+  auto similar = [&](float d1,float d2) {
+    return d1>=0 && d2>=0 && fabs(d1-d2)<=threshold;
+  };
+  
+  // 并查集（根为片段中最小的编号）
+  auto find = [](int32_t* parent,int32_t l) {
+    while (parent[l]!=l) {
+      parent[l] = parent[parent[l]];
+      l = parent[l];
+    }
+    return l;
+  };
+  auto unite = [&](int32_t* parent,int32_t l1,int32_t l2) {
+    l1 = find(parent,l1);
+    l2 = find(parent,l2);
+    if      (l1<l2) parent[l2] = l1;
+    else if (l2<l1) parent[l1] = l2;
+  };
+  
+  // 第 u 列所在的行程：从编号 k 开始向右查找（第 u 列必须属于该行的某个行程）
+  auto run_at = [](const segment_runs &runs,int32_t k,int32_t u) {
+    while (runs.u_end[k]<=u) k++;
+    return k;
+  };
+  
+  // 第一遍：各条带内按行主序划分行程，并与上一行相似的像素所在行程合并
+  pool.run(num_bands,num_bands,[&](int32_t b) {
+    segment_runs &runs = bands[b];
+    runs.u_begin.clear();
+    runs.u_end.clear();
+    runs.parent.clear();
+    runs.size.clear();
+    for (int32_t v=band_v[b]; v<band_v[b+1]; v++) {
+      const float* D_row = D+getAddressOffsetImage(0,v,D_width);
+      int32_t k_above    = v>band_v[b] ? runs.row_begin[v-1-band_v[b]] : 0;
+      runs.row_begin[v-band_v[b]] = (int32_t)runs.u_begin.size();
+      for (int32_t u=0; u<D_width; u++) {
+        float d = D_row[u];
+        if (d<0)
+          continue;
+        int32_t l;
+        if (u>0 && similar(D_row[u-1],d)) {
+          l = (int32_t)runs.u_begin.size()-1;
+          runs.u_end[l] = u+1;
+          runs.size[l]++;
+        } else {
+          l = (int32_t)runs.u_begin.size();
+          runs.u_begin.push_back(u);
+          runs.u_end.push_back(u+1);
+          runs.parent.push_back(l);
+          runs.size.push_back(1);
         }
-      } // 结束：if (*(I_done+addr_start)==0)
-      
+        if (v>band_v[b] && similar(D_row[u-D_width],d)) {
+          k_above = run_at(runs,k_above,u);
+          unite(runs.parent.data(),l,k_above);
+        }
+      }
+    }
+    runs.row_begin[band_v[b+1]-band_v[b]] = (int32_t)runs.u_begin.size();
+  });
+  
+  // 为所有行程统一编号：条带 b 的第 k 个行程编号为 offset[b]+k
+  offset[0] = 0;
+  for (int32_t b=0; b<num_bands; b++)
+    offset[b+1] = offset[b]+(int32_t)bands[b].parent.size();
+  seg_parent[buf].resize(offset[num_bands]);
+  seg_size[buf].resize(offset[num_bands]);
+  int32_t *parent = seg_parent[buf].data();  // 并查集：行程编号 -> 父节点
+  int32_t *size   = seg_size[buf].data();    // 行程长度；合并后根节点处为整个片段的像素数
+  for (int32_t b=0; b<num_bands; b++) {
+    for (int32_t k=0; k<(int32_t)bands[b].parent.size(); k++) {
+      parent[offset[b]+k] = offset[b]+bands[b].parent[k];
+      size[offset[b]+k]   = bands[b].size[k];
     }
   }
   
-  // 释放片段标记相关内存
-  free(D_done);
-  free(seg_list_u);
-  free(seg_list_v);
+  // 合并条带边界两侧相似的像素
+  for (int32_t b=1; b<num_bands; b++) {
+    const segment_runs &above = bands[b-1];
+    const segment_runs &below = bands[b];
+    const float* D_row  = D+getAddressOffsetImage(0,band_v[b],D_width);
+    int32_t k_above = above.row_begin[band_v[b]-1-band_v[b-1]];
+    int32_t k_below = 0;
+    for (int32_t u=0; u<D_width; u++) {
+      if (similar(D_row[u-D_width],D_row[u])) {
+        k_above = run_at(above,k_above,u);
+        k_below = run_at(below,k_below,u);
+        unite(parent,offset[b-1]+k_above,offset[b]+k_below);
+      }
+    }
+  }
+  
+  // 按编号递增的顺序把每个行程直接指向根节点，并把行程长度累加到根节点
+  // （根是片段中最小的编号，访问到某个行程时其根已经累加完毕之前的行程）
+  for (int32_t l=0; l<offset[num_bands]; l++) {
+    int32_t r = find(parent,l);
+    parent[l] = r;
+    if (r!=l)
+      size[r] += size[l];
+  }
+  
+  // 第二遍：将过小片段中的像素以及无效像素（各自单独成为一个片段）置为无效视差
+  pool.run(num_bands,num_bands,[&](int32_t b) {
+    const segment_runs &runs = bands[b];
+    bool remove_invalid = 1<D_speckle_size;
+    for (int32_t v=band_v[b]; v<band_v[b+1]; v++) {
+      float* D_row = D+getAddressOffsetImage(0,v,D_width);
+      int32_t u = 0;
+      for (int32_t k=runs.row_begin[v-band_v[b]]; k<runs.row_begin[v-band_v[b]+1]; k++) {
+        for (; u<runs.u_begin[k]; u++)
+          if (remove_invalid) D_row[u] = -10;
+        if (size[parent[offset[b]+k]]<D_speckle_size)
+          for (; u<runs.u_end[k]; u++)
+            D_row[u] = -10;
+        u = runs.u_end[k];
+      }
+      for (; u<D_width; u++)
+        if (remove_invalid) D_row[u] = -10;
+    }
+  });
 }
 
 void Elas::gapInterpolation(float* D) {
@@ -1105,49 +1747,46 @@ void Elas::gapInterpolation(float* D) {
   }
   
   // 判定深度不连续的阈值
-  float discon_threshold = 3.0;
+  const float discon_threshold = 3.0;
   
-  // 循环辅助变量
-  int32_t count,addr,v_first,v_last,u_first,u_last;
-  float   d1,d2,d_ipol;
+  // 由空洞两端的有效视差计算插值视差（相近时取均值，否则取较小者）
+  auto interpolate = [&](float d1,float d2) {
+    if (fabs(d1-d2)<discon_threshold) return (d1+d2)/2;
+    else                              return min(d1,d2);
+  };
+  
+  // 4 个像素中哪些视差有效（位 i 对应第 i 个像素；与 D>=0 的判断一致）
+  const __m128 zero = _mm_setzero_ps();
+  auto valid_mask = [&](const float* p) {
+    return _mm_movemask_ps(_mm_cmpge_ps(_mm_loadu_ps(p),zero));
+  };
   
   // 1. 按行处理：
   // 对每一行进行扫描
   for (int32_t v=0; v<D_height; v++) {
+    float* D_row = D+getAddressOffsetImage(0,v,D_width);
     
     // 初始化空洞长度计数器
-    count = 0;
+    int32_t count = 0;
     
-    // 遍历该行中的每一个像素
-    for (int32_t u=0; u<D_width; u++) {
-      
-      // 获取当前位置的索引
-      addr = getAddressOffsetImage(u,v,D_width);
+    // 遍历该行中的每一个像素；4 个像素全部有效（且不在空洞中）或全部无效时整组跳过
+    int32_t u = 0;
+    while (u<D_width) {
+      if (u+4<=D_width) {
+        int32_t mask = valid_mask(D_row+u);
+        if (mask==0xF && count==0) { u += 4; continue; }
+        if (mask==0x0)             { u += 4; count += 4; continue; }
+      }
       
       // 若当前视差有效
-      if (*(D+addr)>=0) {
+      if (D_row[u]>=0) {
         
-        // 检查刚刚跨过的空洞是否足够小
-        if (count>=1 && count<=D_ipol_gap_width) {
-          
-          // 插值区间的起始与结束列
-          u_first = u-count;
-          u_last  = u-1;
-          
-          // 若插值区间在图像内部
-          if (u_first>0 && u_last<D_width-1) {
-            
-            // 计算两端视差的均值（或取较小者）
-            d1 = *(D+getAddressOffsetImage(u_first-1,v,D_width));
-            d2 = *(D+getAddressOffsetImage(u_last+1,v,D_width));
-            if (fabs(d1-d2)<discon_threshold) d_ipol = (d1+d2)/2;
-            else                              d_ipol = min(d1,d2);
-            
-            // 将空洞内所有像素赋为插值视差
-            for (int32_t u_curr=u_first; u_curr<=u_last; u_curr++)
-              *(D+getAddressOffsetImage(u_curr,v,D_width)) = d_ipol;
-          }
-          
+        // 检查刚刚跨过的空洞是否足够小，且插值区间在图像内部
+        // （区间 u-count ... u-1 的右端总在图像内部）
+        if (count>=1 && count<=D_ipol_gap_width && u-count>0) {
+          float d_ipol = interpolate(D_row[u-count-1],D_row[u]);
+          for (int32_t u_curr=u-count; u_curr<u; u_curr++)
+            D_row[u_curr] = d_ipol;
         }
         
         // 当前处于有效区域，重置计数
@@ -1157,128 +1796,123 @@ void Elas::gapInterpolation(float* D) {
       } else {
         count++;
       }
+      u++;
     }
     
-    // 若需要完整尺寸的视差图
+    // 若需要完整尺寸的视差图：把行首、行尾的有效视差向外推填补边缘空洞
     if (param.add_corners) {
-
-      // 向左外推填补边缘空洞
-      for (int32_t u=0; u<D_width; u++) {
-
-        // 获取当前位置索引
-        addr = getAddressOffsetImage(u,v,D_width);
-
-        // 找到第一个有效视差像素后，向左填充
-        if (*(D+addr)>=0) {
-          for (int32_t u2=max(u-D_ipol_gap_width,0); u2<u; u2++)
-            *(D+getAddressOffsetImage(u2,v,D_width)) = *(D+addr);
-          break;
-        }
-      }
-
-      // 向右外推填补边缘空洞
-      for (int32_t u=D_width-1; u>=0; u--) {
-
-        // 获取当前位置索引
-        addr = getAddressOffsetImage(u,v,D_width);
-
-        // 找到第一个有效视差像素后，向右填充
-        if (*(D+addr)>=0) {
-          for (int32_t u2=u; u2<=min(u+D_ipol_gap_width,D_width-1); u2++)
-            *(D+getAddressOffsetImage(u2,v,D_width)) = *(D+addr);
-          break;
-        }
+      
+      // 行中第一个有效视差，向左填充
+      int32_t u_first = 0;
+      while (u_first+4<=D_width && valid_mask(D_row+u_first)==0) u_first += 4;
+      while (u_first<D_width && !(D_row[u_first]>=0))            u_first++;
+      if (u_first<D_width) {
+        for (int32_t u2=max(u_first-D_ipol_gap_width,0); u2<u_first; u2++)
+          D_row[u2] = D_row[u_first];
+        
+        // 行中最后一个有效视差，向右填充
+        int32_t u_last = D_width-1;
+        while (u_last-3>=0 && valid_mask(D_row+u_last-3)==0) u_last -= 4;
+        while (!(D_row[u_last]>=0))                          u_last--;
+        for (int32_t u2=u_last; u2<=min(u_last+D_ipol_gap_width,D_width-1); u2++)
+          D_row[u2] = D_row[u_last];
       }
     }
   }
 
-  // 2. Column-wise:      
-  // 对每一列进行处理（垂直方向插值填补空洞）
-  for (int32_t u=0; u<D_width; u++) {
+  // 2. 按列处理（垂直方向插值填补空洞）：
+  // 每次处理相邻的 block 列并逐行向下扫描，每列的空洞计数、空洞上方的有效视差
+  // 以及第一个有效视差所在的行保存在小数组中，按行读取时访问连续内存。
+  // 插值只写回已经扫描过的行，且各列互相独立，结果与逐列扫描相同
+  const int32_t block = 64;
+  int32_t num_blocks  = (D_width+block-1)/block;
+  pool.run(param.num_threads,num_blocks,[&](int32_t b) {
+    int32_t u_begin = b*block;
+    int32_t n       = min(block,D_width-u_begin);
+    int32_t n4      = n-n%4;
+    __m128i count[block/4],v_first_valid[block/4];
+    __m128  d_above[block/4];
+    for (int32_t k=0; k<block/4; k++) {
+      count[k]         = _mm_setzero_si128();
+      v_first_valid[k] = _mm_set1_epi32(-1);
+      d_above[k]       = _mm_setzero_ps();
+    }
+    int32_t* count_i = (int32_t*)count;
+    int32_t* first_i = (int32_t*)v_first_valid;
+    float*   above_f = (float*)d_above;
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i gap = _mm_set1_epi32(D_ipol_gap_width+1);
     
-    // 初始化空洞长度计数器
-    count = 0;
+    // 第 i 列在第 v 行遇到有效视差时的处理：空洞足够小且不位于列首时插值填补
+    auto update = [&](float* D_row,int32_t v,int32_t i) {
+      if (count_i[i]>=1 && count_i[i]<=D_ipol_gap_width && v-count_i[i]>0) {
+        float d_ipol = interpolate(above_f[i],D_row[i]);
+        for (int32_t v_curr=v-count_i[i]; v_curr<v; v_curr++)
+          *(D_row+(v_curr-v)*D_width+i) = d_ipol;
+      }
+    };
     
-    // 遍历该列中的每一个像素
     for (int32_t v=0; v<D_height; v++) {
+      float*  D_row = D+getAddressOffsetImage(u_begin,v,D_width);
+      __m128i v_vec = _mm_set1_epi32(v);
       
-      // 获取当前位置的索引
-      addr = getAddressOffsetImage(u,v,D_width);
+      // 4 列一组：需要插值的列（有效、1<=count<=gap 且 v-count>0）逐列处理，
+      // 其余列只更新计数、空洞上方的有效视差与第一个有效视差所在的行
+      for (int32_t k=0; k<n4/4; k++) {
+        __m128  d     = _mm_loadu_ps(D_row+4*k);
+        __m128i valid = _mm_castps_si128(_mm_cmpge_ps(d,zero));
+        __m128i fill  = _mm_and_si128(_mm_and_si128(valid,_mm_cmpgt_epi32(count[k],_mm_setzero_si128())),
+                                      _mm_and_si128(_mm_cmplt_epi32(count[k],gap),_mm_cmpgt_epi32(v_vec,count[k])));
+        int32_t fill_mask = _mm_movemask_ps(_mm_castsi128_ps(fill));
+        for (int32_t j=0; j<4; j++)
+          if (fill_mask&(1<<j))
+            update(D_row,v,4*k+j);
+        __m128i first_new = _mm_and_si128(valid,_mm_cmplt_epi32(v_first_valid[k],_mm_setzero_si128()));
+        v_first_valid[k] = _mm_or_si128(_mm_andnot_si128(first_new,v_first_valid[k]),_mm_and_si128(first_new,v_vec));
+        d_above[k]       = _mm_or_ps(_mm_andnot_ps(_mm_castsi128_ps(valid),d_above[k]),_mm_and_ps(_mm_castsi128_ps(valid),d));
+        count[k]         = _mm_andnot_si128(valid,_mm_add_epi32(count[k],one));
+      }
       
-      // 如果视差有效
-      if (*(D+addr)>=0) {
-        
-        // 检查空洞是否在允许范围内
-        if (count>=1 && count<=D_ipol_gap_width) {
-          
-          // 确定插值的首尾位置
-          v_first = v-count;
-          v_last  = v-1;
-          
-          // 检查插值范围是否有效
-          if (v_first>0 && v_last<D_height-1) {
-            
-            // 计算平均视差
-            d1 = *(D+getAddressOffsetImage(u,v_first-1,D_width));
-            d2 = *(D+getAddressOffsetImage(u,v_last+1,D_width));
-            if (fabs(d1-d2)<discon_threshold) d_ipol = (d1+d2)/2;
-            else                              d_ipol = min(d1,d2);
-            
-            // 将所有插值位置设为计算出的视差值
-            for (int32_t v_curr=v_first; v_curr<=v_last; v_curr++)
-              *(D+getAddressOffsetImage(u,v_curr,D_width)) = d_ipol;
-          }
-          
+      // 不足 4 列的部分逐列处理
+      for (int32_t i=n4; i<n; i++) {
+        if (D_row[i]>=0) {
+          update(D_row,v,i);
+          count_i[i] = 0;
+          above_f[i] = D_row[i];
+          if (first_i[i]<0) first_i[i] = v;
+        } else {
+          count_i[i]++;
         }
-        
-        // 重置计数器
-        count = 0;
-      
-      // 否则增加计数器
-      } else {
-        count++;
       }
     }
 
     // 向上下外推以填补边缘空洞（因为底部行有时保持未标记）
     // DS 5/12/2014
 
-    // 若需要完整尺寸的视差图
+    // 若需要完整尺寸的视差图：插值不会改变每列第一个和最后一个有效视差，
+    // 最后一个有效视差之下的无效行数即为扫描结束时的计数
     if (param.add_corners) {
-
-      // 向上外推
-      for (int32_t v=0; v<D_height; v++) {
-
-        // 获取当前位置索引
-        addr = getAddressOffsetImage(u,v,D_width);
-
-        // 找到第一个有效视差像素后，向上填充
-        if (*(D+addr)>=0) {
-          for (int32_t v2=max(v-D_ipol_gap_width,0); v2<v; v2++)
-            *(D+getAddressOffsetImage(u,v2,D_width)) = *(D+addr);
-          break;
-        }
-      }
-
-      // 向下外推
-      for (int32_t v=D_height-1; v>=0; v--) {
-
-        // 获取当前位置索引
-        addr = getAddressOffsetImage(u,v,D_width);
-
-        // 找到第一个有效视差像素后，向下填充
-        if (*(D+addr)>=0) {
-          for (int32_t v2=v; v2<=min(v+D_ipol_gap_width,D_height-1); v2++)
-            *(D+getAddressOffsetImage(u,v2,D_width)) = *(D+addr);
-          break;
-        }
+      for (int32_t i=0; i<n; i++) {
+        if (first_i[i]<0)
+          continue;
+        float* D_col = D+u_begin+i;
+        
+        // 向上外推
+        int32_t v = first_i[i];
+        for (int32_t v2=max(v-D_ipol_gap_width,0); v2<v; v2++)
+          *(D_col+v2*D_width) = *(D_col+v*D_width);
+        
+        // 向下外推
+        v = D_height-1-count_i[i];
+        for (int32_t v2=v; v2<=min(v+D_ipol_gap_width,D_height-1); v2++)
+          *(D_col+v2*D_width) = *(D_col+v*D_width);
       }
     }
-  }
+  });
 }
 
 // 该函数实现了对双边滤波的一种近似
-void Elas::adaptiveMean (float* D) {
+void Elas::adaptiveMean (float* D,int32_t buf) {
   
   // 获取视差图尺寸
   int32_t D_width          = width;
@@ -1288,203 +1922,148 @@ void Elas::adaptiveMean (float* D) {
     D_height         = height/2;
   }
   
-  // 分配临时内存
-  float* D_copy = (float*)malloc(D_width*D_height*sizeof(float));
-  float* D_tmp  = (float*)malloc(D_width*D_height*sizeof(float));
-  memcpy(D_copy,D,D_width*D_height*sizeof(float));
+  // 临时图（内存由 reserve 分配）
+  float* D_copy = this->D_copy[buf];
+  float* D_tmp  = this->D_tmp[buf];
   
-  // 将输入视差图中无效的位置置为 -10，使这些区域在双边滤波中权重为 0
-  for (int32_t i=0; i<D_width*D_height; i++) {
-    if (*(D+i)<0) {
-      *(D_copy+i) = -10;
-      *(D_tmp+i)  = -10;
-    }
-  }
+  // 子采样模式下使用 4 像素宽度的双边滤波，全分辨率模式下使用 8 像素宽度；
+  // 窗口 [u-window+1,u] 的结果写在 u-c 处
+  const int32_t window = param.subsampling ? 4 : 8;
+  const int32_t c      = window/2-1;
   
   __m128 xconst0 = _mm_set1_ps(0);
   __m128 xconst4 = _mm_set1_ps(4);
-  __m128 xval,xweight1,xweight2,xfactor1,xfactor2;
-  
-  float *val     = (float *)_mm_malloc(8*sizeof(float),16);
-  float *weight  = (float*)_mm_malloc(4*sizeof(float),16);
-  float *factor  = (float*)_mm_malloc(4*sizeof(float),16);
   
   // 绝对值掩码（用于快速取绝对值）
   __m128 xabsmask = _mm_set1_ps(0x7FFFFFFF);
   
-  // 子采样模式下：使用 4 像素宽度的双边滤波
-  if (param.subsampling) {
-  
-    // 水平滤波
-    for (int32_t v=3; v<D_height-3; v++) {
-
-      // 初始化首几个元素
-      for (int32_t u=0; u<3; u++)
-        val[u] = *(D_copy+v*D_width+u);
-
-      // 主循环
-      for (int32_t u=3; u<D_width; u++) {
-
-        // 更新当前窗口内的值
-        float val_curr = *(D_copy+v*D_width+(u-1));
-        val[u%4] = *(D_copy+v*D_width+u);
-
-        xval     = _mm_load_ps(val);      
-        xweight1 = _mm_sub_ps(xval,_mm_set1_ps(val_curr));
-        xweight1 = _mm_and_ps(xweight1,xabsmask);
-        xweight1 = _mm_sub_ps(xconst4,xweight1);
-        xweight1 = _mm_max_ps(xconst0,xweight1);
-        xfactor1 = _mm_mul_ps(xval,xweight1);
-
-        _mm_store_ps(weight,xweight1);
-        _mm_store_ps(factor,xfactor1);
-
-        float weight_sum = weight[0]+weight[1]+weight[2]+weight[3];
-        float factor_sum = factor[0]+factor[1]+factor[2]+factor[3];
-        
-        if (weight_sum>0) {
-          float d = factor_sum/weight_sum;
-          if (d>=0) *(D_tmp+v*D_width+(u-1)) = d;
-        }
+  // 双边权重及其与视差的乘积
+  auto weight_factor = [&](__m128 xval,__m128 xcurr,__m128 &xweight,__m128 &xfactor) {
+    xweight = _mm_sub_ps(xval,xcurr);
+    xweight = _mm_and_ps(xweight,xabsmask);
+    xweight = _mm_sub_ps(xconst4,xweight);
+    xweight = _mm_max_ps(xconst0,xweight);
+    xfactor = _mm_mul_ps(xval,xweight);
+  };
+  
+  // 4 路加权平均：xval[j] 为窗口中位置 % window == j 的值（每个通道一个输出），
+  // 槽位 j 与 j+4 先相加，再按 0..3 的顺序累加；权重和大于 0 且结果非负的通道写入 out
+  auto mean4 = [&](const __m128* xval,__m128 xcurr,float* out) {
+    __m128 xweight[4],xfactor[4];
+    for (int32_t j=0; j<4; j++) {
+      weight_factor(xval[j],xcurr,xweight[j],xfactor[j]);
+      if (window==8) {
+        __m128 xweight2,xfactor2;
+        weight_factor(xval[j+4],xcurr,xweight2,xfactor2);
+        xweight[j] = _mm_add_ps(xweight[j],xweight2);
+        xfactor[j] = _mm_add_ps(xfactor[j],xfactor2);
       }
     }
-
-    // 垂直滤波
-    for (int32_t u=3; u<D_width-3; u++) {
-
-      // 初始化首几个元素
-      for (int32_t v=0; v<3; v++)
-        val[v] = *(D_tmp+v*D_width+u);
-
-      // 主循环
-      for (int32_t v=3; v<D_height; v++) {
-
-        // 更新当前窗口内的值
-        float val_curr = *(D_tmp+(v-1)*D_width+u);
-        val[v%4] = *(D_tmp+v*D_width+u);
-
-        xval     = _mm_load_ps(val);      
-        xweight1 = _mm_sub_ps(xval,_mm_set1_ps(val_curr));
-        xweight1 = _mm_and_ps(xweight1,xabsmask);
-        xweight1 = _mm_sub_ps(xconst4,xweight1);
-        xweight1 = _mm_max_ps(xconst0,xweight1);
-        xfactor1 = _mm_mul_ps(xval,xweight1);
-
-        _mm_store_ps(weight,xweight1);
-        _mm_store_ps(factor,xfactor1);
-
-        float weight_sum = weight[0]+weight[1]+weight[2]+weight[3];
-        float factor_sum = factor[0]+factor[1]+factor[2]+factor[3];
-        
-        if (weight_sum>0) {
-          float d = factor_sum/weight_sum;
-          if (d>=0) *(D+(v-1)*D_width+u) = d;
-        }
-      }
+    __m128 xweight_sum = _mm_add_ps(_mm_add_ps(_mm_add_ps(xweight[0],xweight[1]),xweight[2]),xweight[3]);
+    __m128 xfactor_sum = _mm_add_ps(_mm_add_ps(_mm_add_ps(xfactor[0],xfactor[1]),xfactor[2]),xfactor[3]);
+    __m128 d  = _mm_div_ps(xfactor_sum,xweight_sum);
+    __m128 ok = _mm_and_ps(_mm_cmpgt_ps(xweight_sum,xconst0),_mm_cmpge_ps(d,xconst0));
+    _mm_storeu_ps(out,_mm_or_ps(_mm_and_ps(ok,d),_mm_andnot_ps(ok,_mm_loadu_ps(out))));
+  };
+  
+  // 单个输出：val[j] 为窗口中位置 % window == j 的值，求和顺序与 mean4 相同
+  auto mean1 = [&](const float* val,float val_curr,float* out) {
+    __m128 xweight1,xfactor1,xweight2,xfactor2;
+    weight_factor(_mm_load_ps(val),_mm_set1_ps(val_curr),xweight1,xfactor1);
+    if (window==8) {
+      weight_factor(_mm_load_ps(val+4),_mm_set1_ps(val_curr),xweight2,xfactor2);
+      xweight1 = _mm_add_ps(xweight1,xweight2);
+      xfactor1 = _mm_add_ps(xfactor1,xfactor2);
     }
     
-  // 全分辨率模式：使用 8 像素宽度的双边滤波
-  } else {
+    // 16 字节对齐的缓冲区
+    __m128 xbuf[2];
+    float *weight = (float*)(xbuf+0);
+    float *factor = (float*)(xbuf+1);
+    _mm_store_ps(weight,xweight1);
+    _mm_store_ps(factor,xfactor1);
     
-  
-    // 水平滤波
-    for (int32_t v=3; v<D_height-3; v++) {
-
-      // 初始化首几个元素
-      for (int32_t u=0; u<7; u++)
-        val[u] = *(D_copy+v*D_width+u);
-
-      // 主循环
-      for (int32_t u=7; u<D_width; u++) {
-
-        // 更新当前窗口内的值
-        float val_curr = *(D_copy+v*D_width+(u-3));
-        val[u%8] = *(D_copy+v*D_width+u);
-
-        xval     = _mm_load_ps(val);      
-        xweight1 = _mm_sub_ps(xval,_mm_set1_ps(val_curr));
-        xweight1 = _mm_and_ps(xweight1,xabsmask);
-        xweight1 = _mm_sub_ps(xconst4,xweight1);
-        xweight1 = _mm_max_ps(xconst0,xweight1);
-        xfactor1 = _mm_mul_ps(xval,xweight1);
-
-        xval     = _mm_load_ps(val+4);      
-        xweight2 = _mm_sub_ps(xval,_mm_set1_ps(val_curr));
-        xweight2 = _mm_and_ps(xweight2,xabsmask);
-        xweight2 = _mm_sub_ps(xconst4,xweight2);
-        xweight2 = _mm_max_ps(xconst0,xweight2);
-        xfactor2 = _mm_mul_ps(xval,xweight2);
-
-        xweight1 = _mm_add_ps(xweight1,xweight2);
-        xfactor1 = _mm_add_ps(xfactor1,xfactor2);
-
-        _mm_store_ps(weight,xweight1);
-        _mm_store_ps(factor,xfactor1);
-
-        float weight_sum = weight[0]+weight[1]+weight[2]+weight[3];
-        float factor_sum = factor[0]+factor[1]+factor[2]+factor[3];
-        
-        if (weight_sum>0) {
-          float d = factor_sum/weight_sum;
-          if (d>=0) *(D_tmp+v*D_width+(u-3)) = d;
-        }
+    float weight_sum = weight[0]+weight[1]+weight[2]+weight[3];
+    float factor_sum = factor[0]+factor[1]+factor[2]+factor[3];
+    
+    if (weight_sum>0) {
+      float d = factor_sum/weight_sum;
+      if (d>=0) *out = d;
+    }
+  };
+  
+  // 各行、各列的滤波互相独立：每个任务处理 16 行，先完成全部水平滤波，再进行垂直滤波
+  const int32_t rows_per_job = 16;
+  int32_t num_jobs = (D_height+rows_per_job-1)/rows_per_job;
+  
+  // 水平滤波（D_copy -> D_tmp）
+  pool.run(param.num_threads,num_jobs,[&](int32_t job) {
+    int32_t v_end = min((job+1)*rows_per_job,D_height);
+    for (int32_t v=job*rows_per_job; v<v_end; v++) {
+      float* D_row    = D+v*D_width;
+      float* copy_row = D_copy+v*D_width;
+      float* tmp_row  = D_tmp+v*D_width;
+      
+      // 将输入视差图中无效的位置置为 -10，使这些区域在双边滤波中权重为 0
+      for (int32_t u=0; u<D_width; u++) {
+        copy_row[u] = D_row[u]<0 ? -10 : D_row[u];
+        tmp_row[u]  = D_row[u]<0 ? -10 : 0;
+      }
+      if (v<3 || v>=D_height-3)
+        continue;
+      
+      // AVX2：每次 8 个位置
+      int32_t u = window-1;
+      if (use_avx2)
+        u = simd::adaptiveMeanRowAVX2(copy_row,tmp_row,D_width,window);
+      
+      // 其余位置使用滑动窗口逐个处理
+      __m128 xval[2];
+      float* val = (float*)xval;
+      for (int32_t k=u-window+1; k<u; k++)
+        val[k%window] = copy_row[k];
+      for (; u<D_width; u++) {
+        val[u%window] = copy_row[u];
+        mean1(val,copy_row[u-c],tmp_row+u-c);
       }
     }
-  
-    // 垂直滤波
-    for (int32_t u=3; u<D_width-3; u++) {
-
-      // 初始化首几个元素
-      for (int32_t v=0; v<7; v++)
-        val[v] = *(D_tmp+v*D_width+u);
-
-      // 主循环
-      for (int32_t v=7; v<D_height; v++) {
-
-        // 更新当前窗口内的值
-        float val_curr = *(D_tmp+(v-3)*D_width+u);
-        val[v%8] = *(D_tmp+v*D_width+u);
-
-        xval     = _mm_load_ps(val);      
-        xweight1 = _mm_sub_ps(xval,_mm_set1_ps(val_curr));
-        xweight1 = _mm_and_ps(xweight1,xabsmask);
-        xweight1 = _mm_sub_ps(xconst4,xweight1);
-        xweight1 = _mm_max_ps(xconst0,xweight1);
-        xfactor1 = _mm_mul_ps(xval,xweight1);
-
-        xval     = _mm_load_ps(val+4);      
-        xweight2 = _mm_sub_ps(xval,_mm_set1_ps(val_curr));
-        xweight2 = _mm_and_ps(xweight2,xabsmask);
-        xweight2 = _mm_sub_ps(xconst4,xweight2);
-        xweight2 = _mm_max_ps(xconst0,xweight2);
-        xfactor2 = _mm_mul_ps(xval,xweight2);
-
-        xweight1 = _mm_add_ps(xweight1,xweight2);
-        xfactor1 = _mm_add_ps(xfactor1,xfactor2);
-
-        _mm_store_ps(weight,xweight1);
-        _mm_store_ps(factor,xfactor1);
-
-        float weight_sum = weight[0]+weight[1]+weight[2]+weight[3];
-        float factor_sum = factor[0]+factor[1]+factor[2]+factor[3];
-        
-        if (weight_sum>0) {
-          float d = factor_sum/weight_sum;
-          if (d>=0) *(D+(v-3)*D_width+u) = d;
-        }
+  });
+  
+  // 垂直滤波（D_tmp -> D）：按行输出，窗口中的各行按行号 % window 排列，
+  // 同一行的各列同时处理
+  pool.run(param.num_threads,num_jobs,[&](int32_t job) {
+    int32_t v_end = min((job+1)*rows_per_job,D_height);
+    for (int32_t v=max(job*rows_per_job,window-1); v<v_end; v++) {
+      const float* rows[8];
+      for (int32_t p=v-window+1; p<=v; p++)
+        rows[p%window] = D_tmp+p*D_width;
+      const float* center = D_tmp+(v-c)*D_width;
+      float*       out    = D+(v-c)*D_width;
+      
+      // AVX2：每次 8 列；SSE：每次 4 列
+      int32_t u = 3;
+      if (use_avx2)
+        u = simd::adaptiveMeanColumnsAVX2(rows,center,out,u,D_width-3,window);
+      for (; u+4<=D_width-3; u+=4) {
+        __m128 xval[8];
+        for (int32_t j=0; j<window; j++)
+          xval[j] = _mm_loadu_ps(rows[j]+u);
+        mean4(xval,_mm_loadu_ps(center+u),out+u);
+      }
+      
+      // 剩余的列逐个处理
+      for (; u<D_width-3; u++) {
+        __m128 xval[2];
+        float* val = (float*)xval;
+        for (int32_t j=0; j<window; j++)
+          val[j] = rows[j][u];
+        mean1(val,center[u],out+u);
       }
     }
-  }
-  
-  // 释放临时内存
-  _mm_free(val);
-  _mm_free(weight);
-  _mm_free(factor);
-  free(D_copy);
-  free(D_tmp);
+  });
 }
 
-void Elas::median (float* D) {
+void Elas::median (float* D,int32_t buf) {
   
   // 获取视差图尺寸
   int32_t D_width          = width;
@@ -1494,60 +2073,83 @@ void Elas::median (float* D) {
     D_height         = height/2;
   }
 
-  // 临时缓冲区
-  float *D_temp = (float*)calloc(D_width*D_height,sizeof(float));
-  
-  int32_t window_size = 3;
-  
-  float *vals = new float[window_size*2+1];
-  int32_t i,j;
-  float temp;
-  
-  // 第一步：水平方向中值滤波
-  for (int32_t u=window_size; u<D_width-window_size; u++) {
-    for (int32_t v=window_size; v<D_height-window_size; v++) {
-      if (*(D+getAddressOffsetImage(u,v,D_width))>=0) {    
-        j = 0;
-        for (int32_t u2=u-window_size; u2<=u+window_size; u2++) {
-          temp = *(D+getAddressOffsetImage(u2,v,D_width));
-          i = j-1;
-          while (i>=0 && *(vals+i)>temp) {
-            *(vals+i+1) = *(vals+i);
-            i--;
-          }
-          *(vals+i+1) = temp;
-          j++;
-        }
-        *(D_temp+getAddressOffsetImage(u,v,D_width)) = *(vals+window_size);
-      } else {
-        *(D_temp+getAddressOffsetImage(u,v,D_width)) = *(D+getAddressOffsetImage(u,v,D_width));
-      }
-        
-    }
-  }
+  // 临时缓冲区（内存由 reserve 分配）
+  float *D_temp = D_tmp[buf];
   
-  // 第二步：垂直方向中值滤波
-  for (int32_t u=window_size; u<D_width-window_size; u++) {
-    for (int32_t v=window_size; v<D_height-window_size; v++) {
-      if (*(D+getAddressOffsetImage(u,v,D_width))>=0) {
-        j = 0;
-        for (int32_t v2=v-window_size; v2<=v+window_size; v2++) {
-          temp = *(D_temp+getAddressOffsetImage(u,v2,D_width));
-          i = j-1;
-          while (i>=0 && *(vals+i)>temp) {
-            *(vals+i+1) = *(vals+i);
-            i--;
-          }
-          *(vals+i+1) = temp;
-          j++;
-        }
-        *(D+getAddressOffsetImage(u,v,D_width)) = *(vals+window_size);
-      } else {
-        *(D+getAddressOffsetImage(u,v,D_width)) = *(D+getAddressOffsetImage(u,v,D_width));
+  const int32_t window_size = 3;
+  
+  // 比较交换：a = min(a,b)，b = max(a,b)
+  auto sort2 = [](__m128 &a,__m128 &b) {
+    __m128 t = a;
+    a = _mm_min_ps(t,b);
+    b = _mm_max_ps(t,b);
+  };
+  
+  // 对第 u_begin ... u_end-1 列做 7 点中值滤波：taps[k] 为第 k 个抽头所在的行，
+  // cond[u]>=0 时 out[u] 为中值，否则为 cond[u]。
+  // 中值由 7 个元素的排序网络（16 个比较器）在 4 个通道上同时求得，结束后 v[3] 为中值
+  auto median_row = [&](const float* const* taps,const float* cond,float* out,int32_t u_begin,int32_t u_end) {
+    int32_t u = u_begin;
+    if (use_avx2)
+      u = simd::median7AVX2(taps,cond,out,u_begin,u_end);
+    for (; u+4<=u_end; u+=4) {
+      __m128 v[7];
+      for (int32_t k=0; k<7; k++)
+        v[k] = _mm_loadu_ps(taps[k]+u);
+      sort2(v[0],v[6]); sort2(v[2],v[3]); sort2(v[4],v[5]);
+      sort2(v[0],v[2]); sort2(v[1],v[4]); sort2(v[3],v[6]);
+      sort2(v[0],v[1]); sort2(v[2],v[5]); sort2(v[3],v[4]);
+      sort2(v[1],v[2]); sort2(v[4],v[6]);
+      sort2(v[2],v[3]); sort2(v[4],v[5]);
+      sort2(v[1],v[2]); sort2(v[3],v[4]); sort2(v[5],v[6]);
+      __m128 c     = _mm_loadu_ps(cond+u);
+      __m128 valid = _mm_cmpge_ps(c,_mm_setzero_ps());
+      _mm_storeu_ps(out+u,_mm_or_ps(_mm_and_ps(valid,v[3]),_mm_andnot_ps(valid,c)));
+    }
+    
+    // 剩余的列逐个排序
+    for (; u<u_end; u++) {
+      if (cond[u]<0) {
+        out[u] = cond[u];
+        continue;
       }
+      float vals[window_size*2+1];
+      for (int32_t k=0; k<7; k++)
+        vals[k] = taps[k][u];
+      std::nth_element(vals,vals+window_size,vals+7);
+      out[u] = vals[window_size];
     }
-  }
-  
-  free(D_temp);
-  free(vals);
+  };
+  
+  // 每个任务处理 16 行，先完成全部水平滤波，再进行垂直滤波
+  const int32_t rows_per_job = 16;
+  int32_t num_jobs = (D_height+rows_per_job-1)/rows_per_job;
+  
+  // 第一步：水平方向中值滤波（D -> D_temp），边界行与边界列置 0
+  pool.run(param.num_threads,num_jobs,[&](int32_t job) {
+    int32_t v_end = min((job+1)*rows_per_job,D_height);
+    for (int32_t v=job*rows_per_job; v<v_end; v++) {
+      const float* D_row    = D+getAddressOffsetImage(0,v,D_width);
+      float*       temp_row = D_temp+getAddressOffsetImage(0,v,D_width);
+      memset(temp_row,0,D_width*sizeof(float));
+      if (v<window_size || v>=D_height-window_size)
+        continue;
+      const float* taps[window_size*2+1];
+      for (int32_t k=0; k<window_size*2+1; k++)
+        taps[k] = D_row+k-window_size;
+      median_row(taps,D_row,temp_row,window_size,D_width-window_size);
+    }
+  });
+  
+  // 第二步：垂直方向中值滤波（D_temp -> D），按行输出
+  pool.run(param.num_threads,num_jobs,[&](int32_t job) {
+    int32_t v_end = min((job+1)*rows_per_job,D_height-window_size);
+    for (int32_t v=max(job*rows_per_job,window_size); v<v_end; v++) {
+      float* D_row = D+getAddressOffsetImage(0,v,D_width);
+      const float* taps[window_size*2+1];
+      for (int32_t k=0; k<window_size*2+1; k++)
+        taps[k] = D_temp+getAddressOffsetImage(0,v+k-window_size,D_width);
+      median_row(taps,D_row,D_row,window_size,D_width-window_size);
+    }
+  });
 }
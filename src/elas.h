@@ -28,6 +28,7 @@ libelas 是自由软件；你可以根据自由软件基金会发布的 GNU 通
 #include <string.h>
 #include <stdlib.h>
 #include <vector>
+#include <utility>
 #include <emmintrin.h>
  
 // 为兼容新版本 Visual Studio：统一使用标准头 <stdint.h> 中定义的定长整数类型
@@ -35,9 +36,9 @@ libelas 是自由软件；你可以根据自由软件基金会发布的 GNU 通
 // 导致 "int8_t: 重定义; 不同的基类型" 之类的编译错误
 #include <stdint.h>
 
-#ifdef PROFILE
-#include "timer.h"
-#endif
+#include "descriptor.h"
+#include "parallel.h"
+#include "delaunay.h"
 
 class Elas {
   
@@ -72,6 +73,39 @@ public:
     bool    subsampling;            // 是否只在每隔一个像素上计算视差以加快速度
                                     // 注意：启用该选项时，D1 和 D2 的尺寸应为
                                     //       width/2 x height/2（向零取整）
+    int32_t num_threads;            // 支持点匹配与稠密匹配使用的线程数（1 = 单线程），
+                                    // 多线程结果与单线程逐位一致
+    bool    parallel_left_right;    // 是否用两个线程同时处理左右两条互相独立的处理链
+                                    // （描述子、三角剖分、平面、网格、稠密匹配，以及
+                                    //  postprocess_only_left 关闭时的后处理）
+    bool    lattice_triangulation;  // 是否使用针对网格支持点的整数 Delaunay 三角剖分（delaunay.h）
+                                    // 代替通用的 Triangle 库；共圆点较多时三角形的
+                                    // 选取可能与 Triangle 不同，但同样满足 Delaunay 性质
+    bool    scanline_matching;      // 是否先光栅化三角形编号、再按行主序进行稠密匹配
+                                    // （缓存更友好，结果与逐三角形匹配逐位一致）
+    bool    simd_dispatch;          // 是否根据 CPUID 在运行时选用 AVX2 匹配内核
+                                    // （关闭或 CPU 不支持时使用 SSE 内核，结果逐位一致）
+    int32_t descriptor_size;        // 每个像素的描述子字节数：16 = 完整 Sobel 描述子，
+                                    // 8 = 精简描述子（内存与匹配带宽减半，精度略降）
+    int32_t band_height;            // 条带流式处理的行数（0 = 关闭）：描述子只为当前条带计算，
+                                    // 随后立即完成该条带的稠密匹配与左右一致性检查，
+                                    // 工作集约为 2*descriptor_size*width*band_height 字节，
+                                    // 宜使其小于 L2 缓存（如 16 ~ 32 行）；结果与整幅处理逐位一致
+    bool    temporal_support;       // 是否用上一帧的支持点候选视差预热本帧的支持点匹配：
+                                    // 只在上一帧视差 ±temporal_radius 的窗口内搜索，
+                                    // 窗口内未通过唯一性检验或最优值落在窗口边界时退回全范围搜索
+                                    // （适用于连续视频帧；结果与逐帧独立计算可能略有不同）
+    int32_t temporal_radius;        // 时域预热的视差搜索半径（小于 5 时不进行预热）
+    bool    support_pyramid;        // 是否由粗到精搜索支持点：先在 2x2 降采样的图像对上做全范围匹配，
+                                    // 再在全分辨率下只搜索 2*d_coarse±pyramid_radius 的窗口
+                                    // （唯一性检验仍在全分辨率下进行；粗层匹配失败的候选点视为无效），
+                                    // 适用于 disp_max 较大的宽基线 / 高分辨率图像
+    int32_t pyramid_radius;         // 由粗到精搜索时全分辨率窗口的半径
+    bool    auto_disp_range;        // 是否由支持点的视差分布自动确定稠密匹配的视差范围：
+                                    // 视差网格、候选列表与平面先验只覆盖支持点视差的
+                                    // [最小值,最大值] 再向两侧各扩展 auto_disp_margin+平面先验半径
+    int32_t auto_disp_margin;       // 自动视差范围在平面先验半径之外额外保留的余量
+    int32_t auto_disp_frames;       // 自动视差范围取最近多少帧的并集（连续视频帧时平滑范围变化，1 为只用当前帧）
     
     // 构造函数：根据不同场景预设参数
     parameters (setting s=ROBOTICS) {
@@ -102,6 +136,20 @@ public:
         filter_adaptive_mean  = 1;
         postprocess_only_left = 1;
         subsampling           = 0;
+        num_threads           = 1;
+        parallel_left_right   = 0;
+        lattice_triangulation = 0;
+        scanline_matching     = 0;
+        simd_dispatch         = 1;
+        descriptor_size       = 16;
+        band_height           = 0;
+        temporal_support      = 0;
+        temporal_radius       = 8;
+        support_pyramid       = 0;
+        pyramid_radius        = 4;
+        auto_disp_range       = 0;
+        auto_disp_margin      = 8;
+        auto_disp_frames      = 1;
         
       // Middlebury 基准测试的默认参数设置
       // （对所有缺失视差进行插值）
@@ -129,15 +177,61 @@ public:
         filter_adaptive_mean  = 0;
         postprocess_only_left = 0;
         subsampling           = 0;
+        num_threads           = 1;
+        parallel_left_right   = 0;
+        lattice_triangulation = 0;
+        scanline_matching     = 0;
+        simd_dispatch         = 1;
+        descriptor_size       = 16;
+        band_height           = 0;
+        temporal_support      = 0;
+        temporal_radius       = 8;
+        support_pyramid       = 0;
+        pyramid_radius        = 4;
+        auto_disp_range       = 0;
+        auto_disp_margin      = 8;
+        auto_disp_frames      = 1;
       }
     }
   };
 
+  // 每帧的统计信息：各阶段耗时（单调时钟，纳秒）与中间结果的数量。
+  // 向 process 传入非空指针时填写；传入空指针时不读取时钟，几乎没有额外开销。
+  // 并行执行的左右两条处理链按所在阶段的墙钟时间计入。
+  // 条带流式处理时，支持点匹配所需的描述子计入 SUPPORT_MATCHES，其余阶段按条带累计。
+  struct Stats {
+    enum stage {INPUT,DESCRIPTOR,SUPPORT_MATCHES,DELAUNAY,PLANES,GRID,MATCHING,
+                LR_CHECK,SEGMENTS,INTERPOLATION,ADAPTIVE_MEAN,MEDIAN,NUM_STAGES};
+    int64_t time_ns[NUM_STAGES];    // 各阶段耗时（未执行的阶段为 0）
+    int64_t total_ns;               // 全部阶段耗时之和
+    int32_t num_support_points;     // 支持点个数（含角点）
+    int32_t num_triangles_left;     // 左图三角形个数
+    int32_t num_triangles_right;    // 右图三角形个数
+    int32_t num_valid_left;         // 最终左视差图中的有效像素数
+    int32_t num_valid_right;        // 最终右视差图中的有效像素数
+    int32_t disp_range_min;         // 稠密匹配实际使用的视差范围（auto_disp_range 时由支持点确定）
+    int32_t disp_range_max;
+    
+    Stats () { reset(); }
+    void reset ();
+    void print () const;                  // 按阶段打印耗时与统计量
+    static const char* stageName (int32_t s);
+  };
+
   // 构造函数，输入：参数集合
-  Elas (parameters param) : param(param) {}
+  Elas (parameters param);
 
-  // 析构函数
-  ~Elas () {}
+  // 析构函数：释放工作缓冲区
+  ~Elas ();
+
+  // 为给定图像尺寸预先分配全部工作缓冲区（对齐图像、描述子、视差网格、
+  // 后处理临时图等）。缓冲区在多次 process 调用之间复用，尺寸不变时
+  // 不会再分配内存；process 在尺寸变化时会自动调用本函数。
+  // 大小随内容变化的缓冲区（支持点、三角形、斑点行程等）只在某一帧超过此前的最大用量时增长。
+  // 以下情况在稳定状态下每帧仍会分配内存：lattice_triangulation = 0 时，Triangle 库
+  // 每次剖分都重新申请其内存池。使用网格三角剖分时稳定状态下不分配内存
+  // （工作线程在构造时创建，见 "./elas verify-alloc"）。
+  void reserve (int32_t width,int32_t height);
   
   // 主匹配函数
   // 输入：左图（I1）和右图（I2）的灰度图指针（uint8，输入）
@@ -148,7 +242,22 @@ public:
   // 说明：调用前必须为 D1 与 D2 分配好内存（每行字节数 = 宽度）；
   //       若未启用 subsampling，则尺寸为 width x height；
   //       若启用了 subsampling，则为 width/2 x height/2（向零取整）。
-  void process (uint8_t* I1,uint8_t* I2,float* D1,float* D2,const int32_t* dims);
+  //       stats 非空时填写本帧的统计信息（见 Stats）。
+  //       输入满足 acceptsInputInPlace 的条件时直接读取调用者的图像，不做拷贝；
+  //       否则先拷贝到内部按 16 字节对齐的缓冲区。两种方式的结果完全相同。
+  void process (uint8_t* I1,uint8_t* I2,float* D1,float* D2,const int32_t* dims,Stats* stats=0);
+
+  // 判断 process 能否直接使用调用者的图像内存（零拷贝）。要求：
+  //   1. I1 与 I2 的地址按 16 字节对齐；
+  //   2. dims[2] 等于宽度向上取整到 16 的倍数（如宽度为 16 的倍数的连续 cv::Mat）；
+  //   3. 每一行的 dims[2] 个字节都可读（包括最后一行），行尾填充字节的内容任意，不影响结果；
+  //   4. process 返回之前调用者不修改这两幅图像。
+  // 条件 1、2 由本函数检查，条件 3、4 由调用者保证
+  static bool acceptsInputInPlace (const uint8_t* I1,const uint8_t* I2,const int32_t* dims);
+
+  // 丢弃时域预热使用的上一帧支持点及最近几帧的自动视差范围（例如场景切换后），
+  // 下一帧重新进行全范围搜索
+  void resetTemporal ();
   
 private:
   
@@ -166,60 +275,154 @@ private:
     triangle(int32_t c1,int32_t c2,int32_t c3):c1(c1),c2(c2),c3(c3){}
   };
 
+  // removeSmallSegments 中一个条带的行程：同一行中相似的相邻有效像素组成一个行程，
+  // 按行主序编号（条带内的第 k 个行程）
+  struct segment_runs {
+    std::vector<int32_t> row_begin;     // 条带内第 i 行第一个行程的编号（末尾另有一项，为行程总数）
+    std::vector<int32_t> u_begin,u_end; // 行程覆盖第 u_begin ... u_end-1 列
+    std::vector<int32_t> parent,size;   // 条带内的并查集与行程长度
+  };
+
   inline uint32_t getAddressOffsetImage (const int32_t& u,const int32_t& v,const int32_t& width) {
     return v*width+u;
   }
 
+  // 描述子图像第 v 行相对于 I_desc 的字节偏移（半分辨率模式下只存储偶数行）
+  inline int32_t descLineOffset (const int32_t& v) {
+    return desc_size*width*(param.subsampling ? v/2 : v);
+  }
+
+  // 读取一个像素的描述子。8 字节描述子被复制到寄存器的高低两半，
+  // 因此 SAD 恰好是 8 字节 SAD 的 2 倍，与 16 字节描述子的代价处于同一量级
+  inline __m128i loadDescriptor (const uint8_t* p) {
+    if (desc_size==16)
+      return _mm_load_si128((const __m128i*)p);
+    return _mm_shuffle_epi32(_mm_loadl_epi64((const __m128i*)p),0x44);
+  }
+
+  // 描述子的纹理强度 sum |b-128|（8 字节描述子同样按 16 字节计）
+  inline int32_t descriptorTexture (const uint8_t* p) {
+    int32_t sum = 0;
+    for (int32_t i=0; i<desc_size; i++)
+      sum += abs((int32_t)(*(p+i))-128);
+    return sum*(16/desc_size);
+  }
+
   inline uint32_t getAddressOffsetGrid (const int32_t& x,const int32_t& y,const int32_t& d,const int32_t& width,const int32_t& disp_num) {
     return (y*width+x)*disp_num+d;
   }
 
+  // 禁止拷贝（对象持有工作缓冲区）
+  Elas (const Elas&);
+  Elas& operator= (const Elas&);
+
+  // 释放全部工作缓冲区
+  void releaseWorkspace ();
+
   // 支持点相关函数
   void removeInconsistentSupportPoints (int16_t* D_can,int32_t D_can_width,int32_t D_can_height);
   void removeRedundantSupportPoints (int16_t* D_can,int32_t D_can_width,int32_t D_can_height,
                                      int32_t redun_max_dist, int32_t redun_threshold, bool vertical);
   void addCornerSupportPoints (std::vector<support_pt> &p_support);
-  inline int16_t computeMatchingDisparity (const int32_t &u,const int32_t &v,uint8_t* I1_desc,uint8_t* I2_desc,const bool &right_image);
-  std::vector<support_pt> computeSupportMatches (uint8_t* I1_desc,uint8_t* I2_desc);
+  inline int16_t computeMatchingDisparity (const int32_t &u,const int32_t &v,uint8_t* I1_desc,uint8_t* I2_desc,const bool &right_image,
+                                           const int32_t &d_lo=0,const int32_t &d_hi=32767,const bool &coarse=false);
+  void computeSupportMatches (uint8_t* I1_desc,uint8_t* I2_desc,std::vector<support_pt> &p_support);
+
+  // 条带流式处理：计算第 v_begin ... v_end-1 行的左右描述子，并返回可按整幅图像行号
+  // （descLineOffset）寻址的基地址
+  void computeDescriptorBand (int32_t v_begin,int32_t v_end,uint8_t* &I1_desc,uint8_t* &I2_desc);
+  
+  // 由支持点的视差确定本帧稠密匹配的视差范围 [disp_lo,disp_hi]，并据此设置视差网格尺寸
+  void updateDisparityRange (const std::vector<support_pt> &p_support);
+  
+  // 由粗到精的支持点搜索：把 I 降采样到 I_pyr，并计算其整幅描述子
+  void computePyramidLevel (const uint8_t* I,uint8_t* I_pyr,Descriptor &desc);
 
   // 三角剖分与离散视差网格
-  std::vector<triangle> computeDelaunayTriangulation (std::vector<support_pt> p_support,int32_t right_image);
-  void computeDisparityPlanes (std::vector<support_pt> p_support,std::vector<triangle> &tri,int32_t right_image);
-  void createGrid (std::vector<support_pt> p_support,int32_t* disparity_grid,int32_t* grid_dims,bool right_image);
+  void computeDelaunayTriangulation (const std::vector<support_pt> &p_support,int32_t right_image,std::vector<triangle> &tri);
+  void computeDisparityPlanes (const std::vector<support_pt> &p_support,std::vector<triangle> &tri,int32_t right_image);
+  void createGrid (const std::vector<support_pt> &p_support,uint16_t* disparity_grid,int32_t* grid_dims,bool right_image);
 
   // 视差匹配
-  inline void updatePosteriorMinimum (__m128i* I2_block_addr,const int32_t &d,const int32_t &w,
+  inline void updatePosteriorMinimum (const uint8_t* I2_block_addr,const int32_t &d,const int32_t &w,
                                       const __m128i &xmm1,__m128i &xmm2,int32_t &val,int32_t &min_val,int32_t &min_d);
-  inline void updatePosteriorMinimum (__m128i* I2_block_addr,const int32_t &d,
+  inline void updatePosteriorMinimum (const uint8_t* I2_block_addr,const int32_t &d,
                                       const __m128i &xmm1,__m128i &xmm2,int32_t &val,int32_t &min_val,int32_t &min_d);
   inline void findMatch (int32_t &u,int32_t &v,float &plane_a,float &plane_b,float &plane_c,
-                         int32_t* disparity_grid,int32_t *grid_dims,uint8_t* I1_desc,uint8_t* I2_desc,
+                         uint16_t* disparity_grid,int32_t *grid_dims,uint8_t* I1_desc,uint8_t* I2_desc,
                          int32_t *P,int32_t &plane_radius,bool &valid,bool &right_image,float* D);
-  void computeDisparity (std::vector<support_pt> p_support,std::vector<triangle> tri,int32_t* disparity_grid,int32_t* grid_dims,
-                         uint8_t* I1_desc,uint8_t* I2_desc,bool right_image,float* D);
+  void computeDisparity (const std::vector<support_pt> &p_support,const std::vector<triangle> &tri,uint16_t* disparity_grid,int32_t* grid_dims,
+                         uint8_t* I1_desc,uint8_t* I2_desc,bool right_image,float* D,int32_t v_begin,int32_t v_end);
+  void computeDisparityRows (const std::vector<support_pt> &p_support,const std::vector<triangle> &tri,uint16_t* disparity_grid,int32_t* grid_dims,
+                             uint8_t* I1_desc,uint8_t* I2_desc,bool right_image,float* D,int32_t v_begin,int32_t v_end,
+                             int32_t* tri_index);
+  inline void markTriangle (const int32_t &u,const int32_t &v,const int32_t &i,int32_t* tri_index);
+  void computeDisparityScanline (const std::vector<support_pt> &p_support,const std::vector<triangle> &tri,uint16_t* disparity_grid,int32_t* grid_dims,
+                                 uint8_t* I1_desc,uint8_t* I2_desc,bool right_image,float* D,int32_t v_begin,int32_t v_end);
 
-  // 左右视差一致性检查
-  void leftRightConsistencyCheck (float* D1,float* D2);
+  // 左右视差一致性检查（只处理视差图的第 D_v_begin ... D_v_end-1 行）
+  void leftRightConsistencyCheck (float* D1,float* D2,int32_t D_v_begin,int32_t D_v_end);
   
-  // 后处理
-  void removeSmallSegments (float* D);
+  // 后处理（buf 选择使用的临时缓冲区组，并行处理左右图时各用一组）
+  void removeSmallSegments (float* D,int32_t buf);
   void gapInterpolation (float* D);
 
   // 可选后处理
-  void adaptiveMean (float* D);
-  void median (float* D);
+  void adaptiveMean (float* D,int32_t buf);
+  void median (float* D,int32_t buf);
   
   // 参数集合
   parameters param;
+
+  // 是否使用 AVX2 内核（由 simd_dispatch 与 CPU 检测结果共同决定）
+  bool use_avx2;
+
+  // 常驻线程池（线程数取 num_threads，左右并行时至少为 2）
+  parallel::Pool pool;
+
+  // 每个像素的描述子字节数（16 或 8，由 descriptor_size 决定）
+  int32_t desc_size;
   
   // 内存按对齐方式存放的输入图像及其尺寸
   uint8_t *I1,*I2;
   int32_t width,height,bpl;
   
-  // 性能分析计时器
-#ifdef PROFILE
-  Timer timer;
-#endif
-};
+  // 本帧实际读取的输入图像：满足零拷贝条件时为调用者的内存，否则为 I1/I2（每行 bpl 字节）
+  const uint8_t *I1_src,*I2_src;
+
+  // 工作缓冲区：由 reserve 按图像尺寸分配，在多帧之间复用
+  int32_t    ws_width,ws_height;            // 当前缓冲区对应的图像尺寸
+  Descriptor desc1,desc2;                   // 左右图描述子
+  int16_t   *D_can;                         // 支持点候选视差网格
+  int16_t   *D_can_prev;                    // 上一帧通过左右验证的候选视差（时域预热）
+  bool       D_can_prev_valid;              // D_can_prev 是否保存了与当前尺寸一致的上一帧结果
+  int32_t   *D_can_support,*D_can_hist;     // removeInconsistentSupportPoints 的邻点计数与窗口视差直方图
+  uint8_t   *I1_pyr,*I2_pyr;                // 由粗到精搜索使用的 2x2 降采样图像
+  int32_t    pyr_width,pyr_height,pyr_bpl;
+  Descriptor desc1_pyr,desc2_pyr;           // 降采样图像的描述子
+  int32_t    D_can_width,D_can_height;
+  int32_t    disp_lo,disp_hi;               // 本帧稠密匹配的视差范围（未启用 auto_disp_range 时为 [0,disp_max]）
+  std::vector<std::pair<int32_t,int32_t> > disp_range_history; // 最近几帧由支持点确定的视差范围（环形缓冲区，构造时分配）
+  int32_t    disp_range_count,disp_range_next; // disp_range_history 中已保存的帧数与下一帧的写入位置
+  int32_t    grid_dims[3];                  // 视差网格尺寸 {disp_hi-disp_lo+2, 宽, 高}
+  uint16_t  *disparity_grid_1,*disparity_grid_2; // 每个单元：候选视差个数及按升序排列的候选视差
+  __m128i   *grid_temp1[2],*grid_temp2[2];  // createGrid 的位图标记与扩散网格（并行时左右图各一套）
+  int32_t    grid_blocks;                   // 每个网格单元的位图占用的 128 位块数（按本帧视差范围）
+  int32_t   *P;                             // 视差差的先验代价表
+  float     *D_copy[2];                     // 自适应均值滤波使用的视差图拷贝
+  float     *lr_rows;                       // 一致性检查的行缓冲区（每个任务一行左视差与一行右视差）
+  float     *D_tmp[2];                      // 滤波使用的中间结果
+  std::vector<segment_runs> seg_runs[2];   // removeSmallSegments 各条带的行程（按需增长，在多帧之间复用）
+  std::vector<int32_t> seg_band_v[2];       // 条带 b 为第 seg_band_v[b] ... seg_band_v[b+1]-1 行
+  std::vector<int32_t> seg_offset[2];       // 条带 b 的行程在合并后的编号从 seg_offset[b] 开始
+  std::vector<int32_t> seg_parent[2],seg_size[2]; // 合并各条带后的并查集与片段像素数
+  int32_t   *tri_index[2];                  // 扫描线匹配模式下覆盖每个像素的三角形编号
+  std::vector<float>      tri_points[2];    // 三角剖分的输入点坐标（左右图各一份）
+  std::vector<int32_t>    lattice_points[2]; // 网格三角剖分的整数点坐标与输出三角形（左右图各一份）
+  std::vector<int32_t>    lattice_tris[2];
+  Delaunay                delaunay[2];      // 网格三角剖分器（左右图各一个，可并行使用）
+  std::vector<support_pt> p_support;        // 支持点
+  std::vector<triangle>   tri_1,tri_2;      // 左右图三角形
+  };
 
 #endif
@@ -71,6 +71,10 @@ namespace filter {
   
   void sobel5x5( const uint8_t* in, uint8_t* out_v, uint8_t* out_h, int w, int h );  // 5x5 Sobel 滤波
   
+  // 2x2 均值降采样：out(u,v) = (in(2u,2v)+in(2u+1,2v)+in(2u,2v+1)+in(2u+1,2v+1)+2)/4，
+  // 输出尺寸为 (w/2)x(h/2)；in_bpl / out_bpl 为输入 / 输出每行字节数
+  void downsample2x2( const uint8_t* in, uint8_t* out, int w, int h, int in_bpl, int out_bpl );
+  
   // -1 -1  0  1  1
   // -1 -1  0  1  1
   //  0  0  0  0  0
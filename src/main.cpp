@@ -21,8 +21,16 @@ libelas 是自由软件；你可以根据自由软件基金会发布的 GNU 通
 // 演示程序：展示如何使用 libelas。可运行 "./elas -h" 查看帮助
 
 #include <iostream>
+#include <iomanip>
 #include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <cstring>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
 #include "elas.h"
 #include "image.h"
 
@@ -152,6 +160,414 @@ void process (const char* file_1,const char* file_2) {
   free(D2_data);
 }
 
+// 随仓库附带的测试图像对（demo 与 bench 共用）
+static const char* g_testPairs[][2] = {
+  {"img/cones_left.pgm",   "img/cones_right.pgm"},
+  {"img/aloe_left.pgm",    "img/aloe_right.pgm"},
+  {"img/raindeer_left.pgm","img/raindeer_right.pgm"},
+  {"img/urban1_left.pgm",  "img/urban1_right.pgm"},
+  {"img/urban2_left.pgm",  "img/urban2_right.pgm"},
+  {"img/urban3_left.pgm",  "img/urban3_right.pgm"},
+  {"img/urban4_left.pgm",  "img/urban4_right.pgm"}
+};
+static const int32_t g_numTestPairs = sizeof(g_testPairs)/sizeof(g_testPairs[0]);
+
+// 读取第 i 对测试图像并填写 dims（每行字节数 = 宽度）；
+// 读取失败或两幅图像尺寸不一致时输出错误信息并返回 false（I1、I2 置空）
+static bool loadPair (int32_t i,image<uchar>* &I1,image<uchar>* &I2,int32_t dims[3]) {
+  I1 = loadImage(g_testPairs[i][0]);
+  I2 = loadImage(g_testPairs[i][1]);
+  if (I1 == nullptr || I2 == nullptr || I1->width() != I2->width() || I1->height() != I2->height()) {
+    cout << "ERROR: Failed to load " << g_testPairs[i][0] << " / " << g_testPairs[i][1] << endl;
+    delete I1;
+    delete I2;
+    I1 = I2 = nullptr;
+    return false;
+  }
+  dims[0] = I1->width();
+  dims[1] = I1->height();
+  dims[2] = I1->width();
+  return true;
+}
+
+// 性能测试：对每对测试图像分别使用 1..max_threads 个线程运行 ELAS，
+// 输出每帧平均耗时（毫秒）以及相对单线程的加速比
+static void benchmark (int32_t max_threads,int32_t repetitions) {
+
+  cout << setw(20) << "image" << setw(10) << "threads" << setw(12) << "ms/frame" << setw(10) << "speedup" << endl;
+
+  for (int32_t i=0; i<g_numTestPairs; i++) {
+    image<uchar> *I1,*I2;
+    int32_t dims[3];
+    if (!loadPair(i,I1,I2,dims))
+      continue;
+    int32_t width  = dims[0];
+    int32_t height = dims[1];
+    vector<float> D1(width * height), D2(width * height);
+
+    double ms_single = 0.0;
+    for (int32_t threads=1; threads<=max_threads; threads++) {
+      Elas::parameters param;
+      param.postprocess_only_left = false;
+      param.num_threads           = threads;
+      Elas elas(param);
+
+      // 预热一次，使工作缓冲区分配不计入耗时
+      elas.process(I1->data, I2->data, D1.data(), D2.data(), dims);
+
+      auto t0 = chrono::steady_clock::now();
+      for (int32_t r=0; r<repetitions; r++)
+        elas.process(I1->data, I2->data, D1.data(), D2.data(), dims);
+      auto t1 = chrono::steady_clock::now();
+      double ms = chrono::duration<double, milli>(t1 - t0).count() / repetitions;
+      if (threads == 1) ms_single = ms;
+
+      cout << setw(20) << g_testPairs[i][0] + 4 << setw(10) << threads
+           << setw(12) << fixed << setprecision(1) << ms
+           << setw(10) << setprecision(2) << ms_single / ms << endl;
+    }
+    delete I1;
+    delete I2;
+  }
+}
+
+// 性能测试：对每对测试图像分别使用 Triangle 库与网格三角剖分（lattice_triangulation）
+// 运行 ELAS，输出三角剖分阶段每帧的平均耗时（毫秒，取自 Elas::Stats）、支持点个数
+// 以及两种结果中视差不同的像素比例
+static void benchmarkTriangulation (int32_t repetitions) {
+
+  cout << setw(20) << "image" << setw(10) << "points" << setw(14) << "triangle ms" << setw(14) << "lattice ms"
+       << setw(10) << "speedup" << setw(12) << "diff %" << endl;
+
+  for (int32_t i=0; i<g_numTestPairs; i++) {
+    image<uchar> *I1,*I2;
+    int32_t dims[3];
+    if (!loadPair(i,I1,I2,dims))
+      continue;
+    int32_t width  = dims[0];
+    int32_t height = dims[1];
+    vector<float> D1[2], D2(width * height);
+
+    double ms[2];
+    Elas::Stats stats;
+    for (int32_t lattice=0; lattice<2; lattice++) {
+      Elas::parameters param;
+      param.lattice_triangulation = lattice;
+      Elas elas(param);
+      D1[lattice].resize(width * height);
+
+      // 预热一次，使工作缓冲区分配不计入耗时
+      elas.process(I1->data, I2->data, D1[lattice].data(), D2.data(), dims);
+
+      int64_t ns = 0;
+      for (int32_t r=0; r<repetitions; r++) {
+        elas.process(I1->data, I2->data, D1[lattice].data(), D2.data(), dims, &stats);
+        ns += stats.time_ns[Elas::Stats::DELAUNAY];
+      }
+      ms[lattice] = ns * 1e-6 / repetitions;
+    }
+
+    // 共圆的网格点可能被两种方法剖分成不同的三角形，统计由此造成的差异
+    int32_t num_diff = 0;
+    for (int32_t k=0; k<width*height; k++)
+      if (D1[0][k] != D1[1][k]) num_diff++;
+
+    cout << setw(20) << g_testPairs[i][0] + 4 << setw(10) << stats.num_support_points
+         << setw(14) << fixed << setprecision(3) << ms[0]
+         << setw(14) << ms[1]
+         << setw(10) << setprecision(2) << ms[0] / ms[1]
+         << setw(12) << 100.0 * num_diff / (width * height) << endl;
+    delete I1;
+    delete I2;
+  }
+}
+
+// 性能测试：对每对测试图像分别使用 16 字节与 8 字节描述子（descriptor_size）运行 ELAS，
+// 输出每帧平均耗时（毫秒）、两幅描述子图像占用的内存（MB）、左视差图的有效像素比例，
+// 以及 16 字节结果中的有效像素在 8 字节结果中视差相差不超过 1 的比例（一致率）
+static void benchmarkDescriptor (int32_t repetitions) {
+
+  cout << setw(20) << "image" << setw(10) << "bytes" << setw(12) << "ms/frame" << setw(10) << "MB"
+       << setw(12) << "valid %" << setw(12) << "agree %" << endl;
+
+  for (int32_t i=0; i<g_numTestPairs; i++) {
+    image<uchar> *I1,*I2;
+    int32_t dims[3];
+    if (!loadPair(i,I1,I2,dims))
+      continue;
+    int32_t width  = dims[0];
+    int32_t height = dims[1];
+    vector<float> D1[2], D2(width * height);
+
+    for (int32_t k=0; k<2; k++) {
+      Elas::parameters param;
+      param.descriptor_size = k==0 ? 16 : 8;
+      Elas elas(param);
+      D1[k].resize(width * height);
+
+      // 预热一次，使工作缓冲区分配不计入耗时
+      elas.process(I1->data, I2->data, D1[k].data(), D2.data(), dims);
+
+      auto t0 = chrono::steady_clock::now();
+      for (int32_t r=0; r<repetitions; r++)
+        elas.process(I1->data, I2->data, D1[k].data(), D2.data(), dims);
+      auto t1 = chrono::steady_clock::now();
+      double ms = chrono::duration<double, milli>(t1 - t0).count() / repetitions;
+
+      int32_t num_valid = 0, num_agree = 0, num_ref = 0;
+      for (int32_t j=0; j<width*height; j++) {
+        if (D1[k][j] >= 0) num_valid++;
+        if (D1[0][j] >= 0) {
+          num_ref++;
+          if (D1[k][j] >= 0 && fabs(D1[k][j] - D1[0][j]) <= 1) num_agree++;
+        }
+      }
+
+      cout << setw(20) << g_testPairs[i][0] + 4 << setw(10) << param.descriptor_size
+           << setw(12) << fixed << setprecision(1) << ms
+           << setw(10) << 2.0 * param.descriptor_size * width * height / (1024 * 1024)
+           << setw(12) << 100.0 * num_valid / (width * height)
+           << setw(12) << 100.0 * num_agree / max(num_ref, 1) << endl;
+    }
+    delete I1;
+    delete I2;
+  }
+}
+
+// 一致性检查：对每对测试图像分别使用 SSE 内核与运行时选择的内核（AVX2）运行 ELAS，
+// 检查两者输出的视差图是否逐位一致（16 字节与 8 字节描述子各检查一次）
+static int verifySimd () {
+
+  int failures = 0;
+  for (int32_t i=0; i<g_numTestPairs; i++) {
+    image<uchar> *I1,*I2;
+    int32_t dims[3];
+    if (!loadPair(i,I1,I2,dims))
+      continue;
+    int32_t width  = dims[0];
+    int32_t height = dims[1];
+
+    for (int32_t s=0; s<4; s++) {
+      vector<float> D1[2], D2[2];
+      for (int32_t dispatch=0; dispatch<2; dispatch++) {
+        Elas::parameters param(s%2==0 ? Elas::ROBOTICS : Elas::MIDDLEBURY);
+        param.postprocess_only_left = false;
+        param.simd_dispatch         = dispatch;
+        param.descriptor_size       = s<2 ? 16 : 8;
+        Elas elas(param);
+        D1[dispatch].resize(width * height);
+        D2[dispatch].resize(width * height);
+        elas.process(I1->data, I2->data, D1[dispatch].data(), D2[dispatch].data(), dims);
+      }
+      bool same = D1[0] == D1[1] && D2[0] == D2[1];
+      if (!same) failures++;
+      cout << setw(20) << g_testPairs[i][0] + 4 << setw(12) << (s%2==0 ? "ROBOTICS" : "MIDDLEBURY")
+           << setw(4) << (s<2 ? 16 : 8) << (same ? "  identical" : "  MISMATCH") << endl;
+    }
+    delete I1;
+    delete I2;
+  }
+  return failures;
+}
+
+// 一致性检查：Triangle 库的可重入性（lattice_triangulation = 0）。先在当前线程中依次处理每对
+// 测试图像，记录左右三角形个数与视差图；再由 num_threads 个线程各自创建 Elas（左右图并行剖分），
+// 以不同的顺序把全部图像处理 rounds 遍，要求每次的结果都与单线程结果逐位一致
+static int verifyTriangleThreads (int32_t num_threads,int32_t rounds) {
+
+  struct Result {
+    vector<float> D1, D2;
+    int32_t num_triangles_left, num_triangles_right;
+  };
+  vector<image<uchar>*> I1(g_numTestPairs, nullptr), I2(g_numTestPairs, nullptr);
+  vector<int32_t> dims(3 * g_numTestPairs), pairs;
+  for (int32_t i=0; i<g_numTestPairs; i++)
+    if (loadPair(i, I1[i], I2[i], &dims[3 * i]))
+      pairs.push_back(i);
+  if (pairs.empty())
+    return 1;
+
+  auto run = [&](Elas &elas, int32_t i, Result &r) {
+    Elas::Stats stats;
+    r.D1.resize(dims[3 * i] * dims[3 * i + 1]);
+    r.D2.resize(dims[3 * i] * dims[3 * i + 1]);
+    elas.process(I1[i]->data, I2[i]->data, r.D1.data(), r.D2.data(), &dims[3 * i], &stats);
+    r.num_triangles_left  = stats.num_triangles_left;
+    r.num_triangles_right = stats.num_triangles_right;
+  };
+
+  Elas::parameters param;
+  param.lattice_triangulation = 0;
+  param.postprocess_only_left = false;
+
+  // 单线程参考结果
+  vector<Result> reference(g_numTestPairs);
+  for (size_t k=0; k<pairs.size(); k++) {
+    Elas elas(param);
+    run(elas, pairs[k], reference[pairs[k]]);
+  }
+
+  // 多个线程同时处理，统计与参考结果不一致的次数
+  param.parallel_left_right = 1;
+  vector<int32_t> mismatches(g_numTestPairs, 0);
+  mutex mismatches_mutex;
+  vector<thread> threads;
+  for (int32_t t=0; t<num_threads; t++) {
+    threads.push_back(thread([&, t]() {
+      Elas elas(param);
+      Result r;
+      for (int32_t round=0; round<rounds; round++) {
+        for (size_t k=0; k<pairs.size(); k++) {
+          int32_t i = pairs[(k + t + round) % pairs.size()];
+          run(elas, i, r);
+          const Result &ref = reference[i];
+          if (r.num_triangles_left != ref.num_triangles_left || r.num_triangles_right != ref.num_triangles_right ||
+              r.D1 != ref.D1 || r.D2 != ref.D2) {
+            lock_guard<mutex> lock(mismatches_mutex);
+            mismatches[i]++;
+          }
+        }
+      }
+    }));
+  }
+  for (size_t t=0; t<threads.size(); t++)
+    threads[t].join();
+
+  int failures = 0;
+  for (size_t k=0; k<pairs.size(); k++) {
+    int32_t i = pairs[k];
+    if (mismatches[i]) failures++;
+    cout << setw(20) << g_testPairs[i][0] + 4
+         << setw(8) << reference[i].num_triangles_left << setw(8) << reference[i].num_triangles_right
+         << setw(6) << num_threads * rounds << " runs"
+         << (mismatches[i] ? "  MISMATCH" : "  identical") << endl;
+  }
+  for (int32_t i=0; i<g_numTestPairs; i++) {
+    delete I1[i];
+    delete I2[i];
+  }
+  return failures;
+}
+
+// 分配计数（verify-alloc 使用），只在 g_countAllocations 为真时计数。
+// glibc 下替换 C 库的 malloc / calloc / realloc / posix_memalign / memalign / aligned_alloc：
+// Elas 的 malloc、_mm_malloc（经 posix_memalign）、Triangle 的内存池以及 operator new
+// 都经过这里。其他平台只替换 operator new，C 库的分配不计入
+static std::atomic<bool>    g_countAllocations(false);
+static std::atomic<int64_t> g_numAllocations(0);
+
+static inline void countAllocation () {
+  if (g_countAllocations) g_numAllocations++;
+}
+
+#ifdef __GLIBC__
+extern "C" {
+void* __libc_malloc (size_t size);
+void* __libc_calloc (size_t num,size_t size);
+void* __libc_realloc (void* p,size_t size);
+void* __libc_memalign (size_t alignment,size_t size);
+
+void* malloc (size_t size) noexcept {
+  countAllocation();
+  return __libc_malloc(size);
+}
+
+void* calloc (size_t num,size_t size) noexcept {
+  countAllocation();
+  return __libc_calloc(num,size);
+}
+
+void* realloc (void* p,size_t size) noexcept {
+  countAllocation();
+  return __libc_realloc(p,size);
+}
+
+void* memalign (size_t alignment,size_t size) noexcept {
+  countAllocation();
+  return __libc_memalign(alignment,size);
+}
+
+void* aligned_alloc (size_t alignment,size_t size) noexcept {
+  countAllocation();
+  return __libc_memalign(alignment,size);
+}
+
+int posix_memalign (void** p,size_t alignment,size_t size) noexcept {
+  countAllocation();
+  *p = __libc_memalign(alignment,size);
+  return *p ? 0 : ENOMEM;
+}
+}
+#else
+void* operator new (size_t size) {
+  countAllocation();
+  void* p = malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete (void* p) noexcept {
+  free(p);
+}
+#endif
+
+// 一致性检查：对每对测试图像和几组参数，先处理 warmup 帧使工作缓冲区达到所需大小，
+// 再处理 frames 帧并统计其间的分配次数。使用网格三角剖分的配置（含多线程、左右并行与
+// 条带流式处理）要求为 0；默认参数使用 Triangle 库，每帧都会重新申请内存池，
+// 要求分配次数大于 0（同时确认计数确实覆盖了库内部的 C 库分配，见 Elas::reserve 的说明）
+static int verifyAllocations (int32_t frames) {
+
+  const int32_t warmup      = 2;
+  const int32_t num_configs = 7;
+  const char* names[num_configs] = { "ROBOTICS", "MIDDLEBURY", "subsampling", "temporal",
+                                     "threads", "streaming", "Triangle" };
+  int failures = 0;
+  for (int32_t i=0; i<g_numTestPairs; i++) {
+    image<uchar> *I1,*I2;
+    int32_t dims[3];
+    if (!loadPair(i,I1,I2,dims))
+      continue;
+    vector<float> D1(dims[0] * dims[1]), D2(dims[0] * dims[1]);
+
+    for (int32_t s=0; s<num_configs; s++) {
+      Elas::parameters param(s==1 || s==3 ? Elas::MIDDLEBURY : Elas::ROBOTICS);
+      bool expect_alloc = s==6;
+      param.lattice_triangulation = !expect_alloc;
+      param.postprocess_only_left = false;
+      if (s==1) param.filter_median    = 1;
+      if (s==2) param.subsampling      = 1;
+      if (s==3) {
+        param.temporal_support = 1;
+        param.auto_disp_range  = 1;
+        param.auto_disp_frames = 15;
+      }
+      if (s==4 || s==5) {
+        param.num_threads         = 4;
+        param.parallel_left_right = 1;
+      }
+      if (s==5) param.band_height = 32;
+      Elas elas(param);
+      for (int32_t r=0; r<warmup; r++)
+        elas.process(I1->data, I2->data, D1.data(), D2.data(), dims);
+
+      g_numAllocations = 0;
+      g_countAllocations = true;
+      for (int32_t r=0; r<frames; r++)
+        elas.process(I1->data, I2->data, D1.data(), D2.data(), dims);
+      g_countAllocations = false;
+
+      int64_t num = g_numAllocations;
+      bool    ok  = expect_alloc ? num > 0 : num == 0;
+      if (!ok) failures++;
+      cout << setw(20) << g_testPairs[i][0] + 4 << setw(14) << names[s] << setw(8) << num
+           << (num == 0 ? "  no allocations" : "  allocated") << (ok ? "" : "  FAILED") << endl;
+    }
+    delete I1;
+    delete I2;
+  }
+  return failures;
+}
+
 static int process_realsense_live(int width, int height, int fps) {
   cout << "XiaoPang 11301901" << endl;
   rs2::pipeline pipe;
@@ -197,6 +613,9 @@ static int process_realsense_live(int width, int height, int fps) {
   param.postprocess_only_left = false;
   param.ipol_gap_width        = 10;
   param.add_corners           = 0;
+  param.temporal_support      = 1;   // 连续帧：用上一帧的支持点视差缩小搜索范围
+  param.auto_disp_range       = 1;   // 稠密匹配只覆盖最近几帧支持点的视差范围
+  param.auto_disp_frames      = 15;
   Elas elas(param);
   cv::Mat prevDepth;
   float prevDispMax = 0.0f;
@@ -228,6 +647,8 @@ static int process_realsense_live(int width, int height, int fps) {
     dims[0] = procL.cols;
     dims[1] = procL.rows;
     dims[2] = (int32_t)procL.step;
+    // OpenCV 分配的连续图像按 16 字节对齐，宽度为 16 的倍数（如 848、1280）时
+    // process 直接读取 procL/procR，不再拷贝（见 Elas::acceptsInputInPlace）
     elas.process(procL.data, procR.data, D1v.data(), D2v.data(), dims);
 
     cv::Mat dispF(sz, CV_32F, D1v.data());
@@ -328,14 +749,63 @@ int main (int argc, char** argv) {
 
   // 运行demo
   if (argc==2 && !strcmp(argv[1],"demo")) {
-    process("img/cones_left.pgm",   "img/cones_right.pgm");
-    process("img/aloe_left.pgm",    "img/aloe_right.pgm");
-    process("img/raindeer_left.pgm","img/raindeer_right.pgm");
-    process("img/urban1_left.pgm",  "img/urban1_right.pgm");
-    process("img/urban2_left.pgm",  "img/urban2_right.pgm");
-    process("img/urban3_left.pgm",  "img/urban3_right.pgm");
-    process("img/urban4_left.pgm",  "img/urban4_right.pgm");
+    for (int32_t i=0; i<g_numTestPairs; i++)
+      process(g_testPairs[i][0], g_testPairs[i][1]);
+    cout << "... done!" << endl;
+
+  // 多线程性能测试
+  } else if (argc>=2 && !strcmp(argv[1],"bench")) {
+    int32_t max_threads = (int32_t)std::thread::hardware_concurrency();
+    int32_t repetitions = 5;
+    if (argc >= 3) max_threads = atoi(argv[2]);
+    if (argc >= 4) repetitions = atoi(argv[3]);
+    if (max_threads < 1) max_threads = 1;
+    if (repetitions < 1) repetitions = 1;
+    benchmark(max_threads, repetitions);
+    cout << "... done!" << endl;
+
+  // 三角剖分方法对比测试
+  } else if (argc>=2 && !strcmp(argv[1],"bench-delaunay")) {
+    int32_t repetitions = 5;
+    if (argc >= 3) repetitions = atoi(argv[2]);
+    if (repetitions < 1) repetitions = 1;
+    benchmarkTriangulation(repetitions);
+    cout << "... done!" << endl;
+
+  // 描述子长度对比测试
+  } else if (argc>=2 && !strcmp(argv[1],"bench-descriptor")) {
+    int32_t repetitions = 5;
+    if (argc >= 3) repetitions = atoi(argv[2]);
+    if (repetitions < 1) repetitions = 1;
+    benchmarkDescriptor(repetitions);
+    cout << "... done!" << endl;
+
+  // SIMD 内核一致性检查（不一致时返回非 0）
+  } else if (argc==2 && !strcmp(argv[1],"verify-simd")) {
+    int failures = verifySimd();
+    cout << "... done!" << endl;
+    return failures ? 1 : 0;
+
+  // Triangle 库多线程一致性检查（不一致时返回非 0）
+  } else if (argc>=2 && !strcmp(argv[1],"verify-triangle")) {
+    int32_t num_threads = 8;
+    int32_t rounds      = 2;
+    if (argc >= 3) num_threads = atoi(argv[2]);
+    if (argc >= 4) rounds = atoi(argv[3]);
+    if (num_threads < 1) num_threads = 1;
+    if (rounds < 1) rounds = 1;
+    int failures = verifyTriangleThreads(num_threads, rounds);
+    cout << "... done!" << endl;
+    return failures ? 1 : 0;
+
+  // 稳定状态下的内存分配检查（有分配时返回非 0）
+  } else if (argc>=2 && !strcmp(argv[1],"verify-alloc")) {
+    int32_t frames = 20;
+    if (argc >= 3) frames = atoi(argv[2]);
+    if (frames < 1) frames = 1;
+    int failures = verifyAllocations(frames);
     cout << "... done!" << endl;
+    return failures ? 1 : 0;
 
   // 从输入图像对计算视差图
   } else if (argc==3) {
@@ -355,6 +825,12 @@ int main (int argc, char** argv) {
     cout << "./elas demo ................ process all test images (image dir)" << endl;
     cout << "./elas left right .......... process a single stereo pair" << endl;
     cout << "./elas realsense [w h fps] . run live with D435i (default 640 480 30)" << endl;
+    cout << "./elas bench [threads reps]  time all test images with 1..threads threads" << endl;
+    cout << "./elas bench-delaunay [reps] compare Triangle and lattice triangulation" << endl;
+    cout << "./elas bench-descriptor [reps] compare 16- and 8-byte descriptors" << endl;
+    cout << "./elas verify-simd ......... check that SSE and AVX2 kernels agree" << endl;
+    cout << "./elas verify-triangle [threads rounds] check concurrent Triangle runs" << endl;
+    cout << "./elas verify-alloc [frames] check that steady-state frames do not allocate" << endl;
     cout << "./elas -h .................. shows this help" << endl;
     cout << endl;
     cout << "Note: Input images are expected to be greylevel images." << endl;
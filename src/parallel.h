@@ -0,0 +1,163 @@
+/*
+本文件是 libelas 的一部分。
+
+libelas 是自由软件；你可以根据自由软件基金会发布的 GNU 通用公共许可证
+（GNU General Public License）第 3 版，或（由你选择的）任何更高版本的条款
+对其进行再发布和/或修改。
+
+发布 libelas 的目的是希望它能发挥作用，但**不提供任何担保**；甚至不包含
+对适销性或特定用途适用性的默示担保。更多细节请参阅 GNU 通用公共许可证。
+
+你应该已经随同 libelas 一起收到了 GNU 通用公共许可证的副本；
+如果没有，请写信至 Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA。
+*/
+// 简单的多线程辅助工具：把若干互不相关的任务分发到多个线程上执行。
+// 任务之间不得有写冲突；结果与任务的执行顺序无关时，多线程输出与单线程完全一致。
+// 工作线程在 Pool 构造时创建一次并在各次调用之间复用，run / invoke 本身不创建线程、
+// 也不分配内存。
+
+#ifndef __PARALLEL_H__
+#define __PARALLEL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+namespace parallel {
+
+  // 常驻线程池。调用线程本身也领取任务，因此任务内部可以再次调用 run / invoke
+  // （例如 invoke 的两个分支各自调用 run）而不会死锁：空闲的工作线程只是协助执行，
+  // 没有空闲线程时调用线程独自完成全部任务。
+  class Pool {
+
+  public:
+
+    // 总共使用 num_threads 个线程（含调用线程），即创建 num_threads-1 个工作线程
+    explicit Pool (int32_t num_threads) : tasks(0),stop(false) {
+      for (int32_t t=1; t<num_threads; t++)
+        workers.push_back(std::thread(&Pool::work,this));
+    }
+
+    ~Pool () {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        stop = true;
+      }
+      wake.notify_all();
+      for (size_t t=0; t<workers.size(); t++)
+        workers[t].join();
+    }
+
+    // 执行 job(0) ... job(num_jobs-1)，最多使用 num_threads 个线程（含调用线程）。
+    // 任务按原子计数器动态领取，以平衡各线程的负载。
+    template <class Job>
+    void run (int32_t num_threads,int32_t num_jobs,const Job &job) {
+      if (num_threads>num_jobs) num_threads = num_jobs;
+      if (num_threads<=1 || workers.empty()) {
+        for (int32_t i=0; i<num_jobs; i++)
+          job(i);
+        return;
+      }
+      Task task(&call<Job>,&job,num_jobs,num_threads-1);
+      execute(task);
+    }
+
+    // 执行两个互不相关的任务；concurrent 为真且有空闲工作线程时两个任务同时执行
+    template <class JobA,class JobB>
+    void invoke (bool concurrent,const JobA &job_a,const JobB &job_b) {
+      if (!concurrent) {
+        job_a();
+        job_b();
+        return;
+      }
+      run(2,2,[&](int32_t i) { if (i==0) job_a(); else job_b(); });
+    }
+
+  private:
+
+    Pool (const Pool&);
+    Pool& operator= (const Pool&);
+
+    // 一次 run 调用；位于调用线程的栈上，通过 link 串入活动任务链表
+    struct Task {
+      void          (*fn)(const void*,int32_t);
+      const void*   job;
+      int32_t       num_jobs;
+      int32_t       max_helpers;  // 允许协助的工作线程数
+      int32_t       helpers;      // 已加入的工作线程数（受 mutex 保护）
+      int32_t       active;       // 仍在执行本任务的工作线程数（受 mutex 保护）
+      std::atomic<int32_t> next;
+      Task*         link;
+      Task (void (*fn)(const void*,int32_t),const void* job,int32_t num_jobs,int32_t max_helpers) :
+        fn(fn),job(job),num_jobs(num_jobs),max_helpers(max_helpers),helpers(0),active(0),next(0),link(0) {}
+    };
+
+    template <class Job>
+    static void call (const void* job,int32_t i) { (*static_cast<const Job*>(job))(i); }
+
+    static void drain (Task &task) {
+      for (int32_t i=task.next++; i<task.num_jobs; i=task.next++)
+        task.fn(task.job,i);
+    }
+
+    // 还有未领取的子任务且协助线程未满的活动任务
+    Task* findTask () {
+      for (Task* t=tasks; t; t=t->link)
+        if (t->helpers<t->max_helpers && t->next.load()<t->num_jobs)
+          return t;
+      return 0;
+    }
+
+    void execute (Task &task) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        task.link = tasks;
+        tasks     = &task;
+      }
+      wake.notify_all();
+      drain(task);
+      
+      // 从链表中摘下任务后等待协助线程离开，之后 task 所在的栈帧才能失效
+      std::unique_lock<std::mutex> lock(mutex);
+      for (Task** t=&tasks; *t; t=&(*t)->link) {
+        if (*t==&task) {
+          *t = task.link;
+          break;
+        }
+      }
+      while (task.active>0)
+        done.wait(lock);
+    }
+
+    void work () {
+      std::unique_lock<std::mutex> lock(mutex);
+      for (;;) {
+        Task* task = 0;
+        while (!stop && (task=findTask())==0)
+          wake.wait(lock);
+        if (stop)
+          return;
+        task->helpers++;
+        task->active++;
+        lock.unlock();
+        drain(*task);
+        lock.lock();
+        if (--task->active==0)
+          done.notify_all();
+      }
+    }
+
+    std::vector<std::thread> workers;
+    std::mutex               mutex;
+    std::condition_variable  wake;   // 有新任务或需要退出
+    std::condition_variable  done;   // 某个任务的协助线程全部离开
+    Task*                    tasks;  // 活动任务链表（受 mutex 保护）
+    bool                     stop;
+  };
+}
+
+#endif
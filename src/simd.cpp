@@ -0,0 +1,68 @@
+/*
+本文件是 libelas 的一部分。
+
+libelas 是自由软件；你可以根据自由软件基金会发布的 GNU 通用公共许可证
+（GNU General Public License）第 3 版，或（由你选择的）任何更高版本的条款
+对其进行再发布和/或修改。
+
+发布 libelas 的目的是希望它能发挥作用，但**不提供任何担保**；甚至不包含
+对适销性或特定用途适用性的默示担保。更多细节请参阅 GNU 通用公共许可证。
+
+你应该已经随同 libelas 一起收到了 GNU 通用公共许可证的副本；
+如果没有，请写信至 Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA。
+*/
+
+#include "simd.h"
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// 执行 CPUID 指令：info = {eax,ebx,ecx,edx}
+static void cpuid (uint32_t info[4],uint32_t leaf,uint32_t subleaf) {
+#ifdef _MSC_VER
+  int32_t regs[4];
+  __cpuidex(regs,leaf,subleaf);
+  for (int32_t i=0; i<4; i++)
+    info[i] = regs[i];
+#else
+  __cpuid_count(leaf,subleaf,info[0],info[1],info[2],info[3]);
+#endif
+}
+
+// 读取扩展控制寄存器 XCR0（操作系统是否保存 AVX 寄存器状态）
+static uint64_t xgetbv0 () {
+#ifdef _MSC_VER
+  return _xgetbv(0);
+#else
+  uint32_t eax,edx;
+  __asm__ __volatile__ ("xgetbv" : "=a"(eax),"=d"(edx) : "c"(0));
+  return ((uint64_t)edx<<32)|eax;
+#endif
+}
+
+static bool detectAVX2 () {
+  uint32_t info[4];
+  cpuid(info,0,0);
+  if (info[0]<7)
+    return false;
+  
+  // CPU 支持 AVX 且操作系统启用了 XSAVE，并保存 XMM/YMM 寄存器
+  cpuid(info,1,0);
+  bool osxsave = (info[2]&(1u<<27))!=0;
+  bool avx     = (info[2]&(1u<<28))!=0;
+  if (!osxsave || !avx || (xgetbv0()&6)!=6)
+    return false;
+  
+  // 扩展特性：EBX 第 5 位为 AVX2
+  cpuid(info,7,0);
+  return (info[1]&(1u<<5))!=0;
+}
+
+bool simd::cpuSupportsAVX2 () {
+  static const bool supported = detectAVX2();
+  return supported;
+}
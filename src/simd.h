@@ -0,0 +1,74 @@
+/*
+本文件是 libelas 的一部分。
+
+libelas 是自由软件；你可以根据自由软件基金会发布的 GNU 通用公共许可证
+（GNU General Public License）第 3 版，或（由你选择的）任何更高版本的条款
+对其进行再发布和/或修改。
+
+发布 libelas 的目的是希望它能发挥作用，但**不提供任何担保**；甚至不包含
+对适销性或特定用途适用性的默示担保。更多细节请参阅 GNU 通用公共许可证。
+
+你应该已经随同 libelas 一起收到了 GNU 通用公共许可证的副本；
+如果没有，请写信至 Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA。
+*/
+
+// 运行时 CPU 指令集检测，以及按指令集编译的计算内核。
+// simd_avx2.cpp 单独以 AVX2 选项编译，其中的函数只能在 cpuSupportsAVX2() 为真时调用；
+// 其余代码仍按 SSE 编译，在不支持 AVX2 的 CPU 上使用原有的 SSE 实现。
+
+#ifndef __SIMD_H__
+#define __SIMD_H__
+
+#include <stdint.h>
+
+namespace simd {
+
+  // 当前 CPU 与操作系统是否支持 AVX2（只检测一次）
+  bool cpuSupportsAVX2 ();
+
+  // 支持点匹配：计算 num 个连续视差 disp_min .. disp_min+num-1 的匹配代价
+  // （4 个描述子块的 SAD 之和），并求最佳与次佳代价。
+  // 输入：I1_block    = 左块中心地址
+  //       I2_block    = 视差 disp_min 对应的右块中心地址，相邻视差的地址相差 step（±desc_size）
+  //       desc_offset = 4 个描述子块相对中心的偏移
+  //       desc_size   = 描述子字节数（16 或 8；8 字节描述子的代价按复制到 16 字节计，即 SAD 的 2 倍）
+  // 输出：min_1_E / min_1_d = 最小代价及其（第一次出现的）视差，
+  //       min_2_E          = 除该视差外其余候选中的最小代价（与逐个比较的 SSE 版本一致）
+  void supportMatchAVX2 (const uint8_t* I1_block,const uint8_t* I2_block,int32_t step,const int32_t* desc_offset,
+                         int32_t disp_min,int32_t num,int32_t desc_size,int32_t &min_1_E,int32_t &min_1_d,int32_t &min_2_E);
+
+  // 稠密匹配：依次计算 num 个候选的代价 SAD(I1_block,I2_line+offset[k])+weight[k]
+  // （desc_size 的含义同上），
+  // 若某个代价严格小于当前的 min_val，则更新 min_val 与 min_d = disp[k]
+  // （按候选顺序取第一次出现的最小值，与逐个比较的 SSE 版本一致）
+  void posteriorMinimumAVX2 (const uint8_t* I1_block,const uint8_t* I2_line,const int32_t* offset,const int32_t* weight,
+                             const int32_t* disp,int32_t num,int32_t desc_size,int32_t &min_val,int32_t &min_d);
+
+  // 左右一致性检查（一行）：D1_in / D2_in 为该行左右视差的副本，结果写入 D1_out / D2_out。
+  // 对每个像素 u：u_warp = u∓scale*d 落在 [0,width) 内且另一幅视差图在 (int)u_warp 处的视差
+  // 与 d 之差不超过 threshold 时保留 d，否则写入 -10（与逐像素的 SSE 版本一致）。
+  // 每次处理 8 个像素，返回已处理的像素数（8 的倍数），剩余像素由调用者处理
+  int32_t lrCheckRowAVX2 (const float* D1_in,const float* D2_in,float* D1_out,float* D2_out,
+                          int32_t width,float scale,float threshold);
+
+  // 自适应均值滤波，水平方向（一行）：对 u = window-1, window, ... 的每个位置，
+  // 以 in[u-window+1 .. u] 这 window 个值（window = 4 或 8）相对中心值 in[u-window/2+1] 求双边加权平均，
+  // 权重和大于 0 且结果非负时写入 out[u-window/2+1]。
+  // 每次处理 8 个位置，各项按 (位置 % window) 的顺序求和，与逐像素的 SSE 版本结果一致；
+  // 返回下一个未处理的 u，剩余位置由调用者处理
+  int32_t adaptiveMeanRowAVX2 (const float* in,float* out,int32_t width,int32_t window);
+
+  // 自适应均值滤波，垂直方向（一行输出）：rows[j] 为窗口中行号 % window == j 的那一行，
+  // center 为中心行，对第 u_begin ... u_end-1 列计算与上面相同的加权平均并写入 out。
+  // 每次处理 8 列，返回下一个未处理的列，剩余列由调用者处理
+  int32_t adaptiveMeanColumnsAVX2 (const float* const* rows,const float* center,float* out,
+                                   int32_t u_begin,int32_t u_end,int32_t window);
+
+  // 7 点中值滤波（一行）：taps[k] 为第 k 个抽头所在的行（k = 0..6），对第 u_begin ... u_end-1 列，
+  // cond[u]>=0 时 out[u] 为 taps[0..6][u] 的中值，否则为 cond[u]（排序网络，无分支）。
+  // 每次处理 8 列，返回下一个未处理的列，剩余列由调用者处理
+  int32_t median7AVX2 (const float* const* taps,const float* cond,float* out,int32_t u_begin,int32_t u_end);
+}
+
+#endif
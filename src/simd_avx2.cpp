@@ -0,0 +1,309 @@
+/*
+本文件是 libelas 的一部分。
+
+libelas 是自由软件；你可以根据自由软件基金会发布的 GNU 通用公共许可证
+（GNU General Public License）第 3 版，或（由你选择的）任何更高版本的条款
+对其进行再发布和/或修改。
+
+发布 libelas 的目的是希望它能发挥作用，但**不提供任何担保**；甚至不包含
+对适销性或特定用途适用性的默示担保。更多细节请参阅 GNU 通用公共许可证。
+
+你应该已经随同 libelas 一起收到了 GNU 通用公共许可证的副本；
+如果没有，请写信至 Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA。
+*/
+
+// AVX2 计算内核（本文件以 -mavx2 或 /arch:AVX2 单独编译，见 CMakeLists.txt）。
+// 每条 _mm256_sad_epu8 同时计算两个候选视差的 SAD；每次循环处理 8 个候选，
+// 代价打包为 8 个 32 位通道（通道顺序为候选 0,2,4,6,1,3,5,7），
+// 最小值及其下标在向量寄存器中逐通道维护，最后再做一次跨通道归约。
+
+#include "simd.h"
+#include <immintrin.h>
+
+namespace {
+
+  // 8 个通道对应的候选下标（与 pack8 的通道顺序一致）
+  inline __m256i laneIndex () {
+    return _mm256_setr_epi32(0,2,4,6,1,3,5,7);
+  }
+
+  // 读取一个描述子块；8 字节描述子复制到高低两半（与 Elas::loadDescriptor 一致）
+  inline __m128i load1 (const uint8_t* p,int32_t desc_size) {
+    if (desc_size==16)
+      return _mm_load_si128((const __m128i*)p);
+    return _mm_shuffle_epi32(_mm_loadl_epi64((const __m128i*)p),0x44);
+  }
+
+  // 将两个描述子块装入一个 256 位寄存器，并与 xmm1（两个 128 位通道相同）求 SAD
+  inline __m256i sad2 (const __m256i &xmm1,const uint8_t* p0,const uint8_t* p1,int32_t desc_size) {
+    __m256i b = _mm256_inserti128_si256(_mm256_castsi128_si256(load1(p0,desc_size)),load1(p1,desc_size),1);
+    return _mm256_sad_epu8(xmm1,b);
+  }
+
+  // 把 4 个 SAD 结果（各含 2 个候选，每个候选为两个 64 位部分和）
+  // 合并为 8 个 32 位代价：低 128 位为候选 0,2,4,6，高 128 位为候选 1,3,5,7
+  inline __m256i pack8 (__m256i s0,__m256i s1,__m256i s2,__m256i s3) {
+    s0 = _mm256_add_epi32(s0,_mm256_srli_si256(s0,8));
+    s1 = _mm256_add_epi32(s1,_mm256_srli_si256(s1,8));
+    s2 = _mm256_add_epi32(s2,_mm256_srli_si256(s2,8));
+    s3 = _mm256_add_epi32(s3,_mm256_srli_si256(s3,8));
+    return _mm256_unpacklo_epi64(_mm256_unpacklo_epi32(s0,s1),_mm256_unpacklo_epi32(s2,s3));
+  }
+
+  // 单个候选的 SAD（尾部候选使用）
+  inline int32_t sad1 (const __m128i &xmm1,const uint8_t* p,int32_t desc_size) {
+    __m128i s = _mm_sad_epu8(xmm1,load1(p,desc_size));
+    return _mm_cvtsi128_si32(s)+_mm_extract_epi16(s,4);
+  }
+
+  // 自适应均值滤波的双边权重：max(0,4-|val-center|)，|.| 使用 Elas::adaptiveMean 中相同的掩码
+  inline __m256 meanWeight (const __m256 &val,const __m256 &center) {
+    const __m256 absmask = _mm256_set1_ps(0x7FFFFFFF);
+    __m256 w = _mm256_and_ps(_mm256_sub_ps(val,center),absmask);
+    return _mm256_max_ps(_mm256_setzero_ps(),_mm256_sub_ps(_mm256_set1_ps(4),w));
+  }
+
+  // 由 window 个槽位的值求加权平均（槽位 j 与 j+4 先相加，再按 0..3 的顺序累加，
+  // 与 SSE 版本的求和顺序相同）；权重和大于 0 且结果非负的通道写入 out
+  inline void meanStore (const __m256* val,const __m256 &center,int32_t window,float* out) {
+    __m256 weight[4],factor[4];
+    for (int32_t j=0; j<4; j++) {
+      weight[j] = meanWeight(val[j],center);
+      factor[j] = _mm256_mul_ps(val[j],weight[j]);
+      if (window==8) {
+        __m256 w  = meanWeight(val[j+4],center);
+        weight[j] = _mm256_add_ps(weight[j],w);
+        factor[j] = _mm256_add_ps(factor[j],_mm256_mul_ps(val[j+4],w));
+      }
+    }
+    __m256 weight_sum = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(weight[0],weight[1]),weight[2]),weight[3]);
+    __m256 factor_sum = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(factor[0],factor[1]),factor[2]),factor[3]);
+    __m256 d  = _mm256_div_ps(factor_sum,weight_sum);
+    __m256 ok = _mm256_and_ps(_mm256_cmp_ps(weight_sum,_mm256_setzero_ps(),_CMP_GT_OQ),
+                              _mm256_cmp_ps(d,_mm256_setzero_ps(),_CMP_GE_OQ));
+    _mm256_storeu_ps(out,_mm256_blendv_ps(_mm256_loadu_ps(out),d,ok));
+  }
+
+  // 比较交换：a = min(a,b)，b = max(a,b)
+  inline void sort2 (__m256 &a,__m256 &b) {
+    __m256 t = a;
+    a = _mm256_min_ps(t,b);
+    b = _mm256_max_ps(t,b);
+  }
+
+  // 7 个元素的排序网络（16 个比较器），结束后 v[3] 为中值；
+  // 不影响 v[3] 的 min/max 结果未被使用，由编译器消除
+  inline void median7 (__m256* v) {
+    sort2(v[0],v[6]); sort2(v[2],v[3]); sort2(v[4],v[5]);
+    sort2(v[0],v[2]); sort2(v[1],v[4]); sort2(v[3],v[6]);
+    sort2(v[0],v[1]); sort2(v[2],v[5]); sort2(v[3],v[4]);
+    sort2(v[1],v[2]); sort2(v[4],v[6]);
+    sort2(v[2],v[3]); sort2(v[4],v[5]);
+    sort2(v[1],v[2]); sort2(v[3],v[4]); sort2(v[5],v[6]);
+  }
+}
+
+void simd::supportMatchAVX2 (const uint8_t* I1_block,const uint8_t* I2_block,int32_t step,const int32_t* desc_offset,
+                             int32_t disp_min,int32_t num,int32_t desc_size,int32_t &min_1_E,int32_t &min_1_d,int32_t &min_2_E) {
+  
+  // 左块的 4 个描述子块（两个 128 位通道中相同）
+  __m128i xmm1[4];
+  __m256i ymm1[4];
+  for (int32_t j=0; j<4; j++) {
+    xmm1[j] = load1(I1_block+desc_offset[j],desc_size);
+    ymm1[j] = _mm256_broadcastsi128_si256(xmm1[j]);
+  }
+  
+  // 逐通道维护最佳代价 b1（及其下标 i1）和次佳代价 b2
+  __m256i b1 = _mm256_set1_epi32(32767);
+  __m256i b2 = _mm256_set1_epi32(32767);
+  __m256i i1 = _mm256_set1_epi32(-1);
+  __m256i idx   = laneIndex();
+  __m256i eight = _mm256_set1_epi32(8);
+  
+  int32_t k = 0;
+  for (; k+8<=num; k+=8) {
+    const uint8_t* p = I2_block+k*step;
+    __m256i s[4];
+    for (int32_t c=0; c<4; c++) {
+      const uint8_t* p0 = p+(2*c)*step;
+      const uint8_t* p1 = p0+step;
+      __m256i acc = sad2(ymm1[0],p0+desc_offset[0],p1+desc_offset[0],desc_size);
+      acc = _mm256_add_epi32(acc,sad2(ymm1[1],p0+desc_offset[1],p1+desc_offset[1],desc_size));
+      acc = _mm256_add_epi32(acc,sad2(ymm1[2],p0+desc_offset[2],p1+desc_offset[2],desc_size));
+      acc = _mm256_add_epi32(acc,sad2(ymm1[3],p0+desc_offset[3],p1+desc_offset[3],desc_size));
+      s[c] = acc;
+    }
+    __m256i x    = pack8(s[0],s[1],s[2],s[3]);
+    __m256i less = _mm256_cmpgt_epi32(b1,x);
+    b2  = _mm256_blendv_epi8(_mm256_min_epi32(b2,x),b1,less);
+    b1  = _mm256_min_epi32(b1,x);
+    i1  = _mm256_blendv_epi8(i1,idx,less);
+    idx = _mm256_add_epi32(idx,eight);
+  }
+  
+  // 跨通道归约：最佳代价取下标最小者，次佳代价为其余通道的最佳代价与所有次佳代价中的最小值
+  int32_t B1[8],I1[8],B2[8];
+  _mm256_storeu_si256((__m256i*)B1,b1);
+  _mm256_storeu_si256((__m256i*)I1,i1);
+  _mm256_storeu_si256((__m256i*)B2,b2);
+  int32_t best = 0;
+  for (int32_t l=1; l<8; l++)
+    if (B1[l]<B1[best] || (B1[l]==B1[best] && (unsigned)I1[l]<(unsigned)I1[best]))
+      best = l;
+  int32_t E1 = B1[best], d1 = I1[best], E2 = 32767;
+  for (int32_t l=0; l<8; l++) {
+    if (B2[l]<E2) E2 = B2[l];
+    if (l!=best && B1[l]<E2) E2 = B1[l];
+  }
+  
+  // 剩余不足 8 个的候选按顺序逐个处理
+  for (; k<num; k++) {
+    const uint8_t* p = I2_block+k*step;
+    int32_t sum = sad1(xmm1[0],p+desc_offset[0],desc_size)+sad1(xmm1[1],p+desc_offset[1],desc_size)+
+                  sad1(xmm1[2],p+desc_offset[2],desc_size)+sad1(xmm1[3],p+desc_offset[3],desc_size);
+    if (sum<E1) {
+      E2 = E1;
+      E1 = sum;
+      d1 = k;
+    } else if (sum<E2) {
+      E2 = sum;
+    }
+  }
+  
+  min_1_E = E1;
+  min_1_d = d1>=0 ? disp_min+d1 : -1;
+  min_2_E = E2;
+}
+
+void simd::posteriorMinimumAVX2 (const uint8_t* I1_block,const uint8_t* I2_line,const int32_t* offset,const int32_t* weight,
+                                 const int32_t* disp,int32_t num,int32_t desc_size,int32_t &min_val,int32_t &min_d) {
+  
+  __m128i xmm1 = load1(I1_block,desc_size);
+  __m256i ymm1 = _mm256_broadcastsi128_si256(xmm1);
+  
+  // 逐通道维护最小代价及其候选下标
+  __m256i b     = _mm256_set1_epi32(min_val);
+  __m256i bi    = _mm256_set1_epi32(-1);
+  __m256i idx   = laneIndex();
+  __m256i eight = _mm256_set1_epi32(8);
+  __m256i perm  = laneIndex();
+  
+  int32_t k = 0;
+  for (; k+8<=num; k+=8) {
+    const int32_t* o = offset+k;
+    __m256i x = pack8(sad2(ymm1,I2_line+o[0],I2_line+o[1],desc_size),sad2(ymm1,I2_line+o[2],I2_line+o[3],desc_size),
+                      sad2(ymm1,I2_line+o[4],I2_line+o[5],desc_size),sad2(ymm1,I2_line+o[6],I2_line+o[7],desc_size));
+    __m256i w = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i*)(weight+k)),perm);
+    x = _mm256_add_epi32(x,w);
+    __m256i less = _mm256_cmpgt_epi32(b,x);
+    b   = _mm256_min_epi32(b,x);
+    bi  = _mm256_blendv_epi8(bi,idx,less);
+    idx = _mm256_add_epi32(idx,eight);
+  }
+  
+  // 跨通道归约：代价相同时取下标最小者；没有任何通道被更新时保持原值
+  int32_t B[8],BI[8];
+  _mm256_storeu_si256((__m256i*)B,b);
+  _mm256_storeu_si256((__m256i*)BI,bi);
+  int32_t best = -1;
+  for (int32_t l=0; l<8; l++)
+    if (BI[l]>=0 && (best<0 || B[l]<B[best] || (B[l]==B[best] && BI[l]<BI[best])))
+      best = l;
+  if (best>=0) {
+    min_val = B[best];
+    min_d   = disp[BI[best]];
+  }
+  
+  // 剩余不足 8 个的候选按顺序逐个处理
+  for (; k<num; k++) {
+    int32_t val = sad1(xmm1,I2_line+offset[k],desc_size)+weight[k];
+    if (val<min_val) {
+      min_val = val;
+      min_d   = disp[k];
+    }
+  }
+}
+
+int32_t simd::lrCheckRowAVX2 (const float* D1_in,const float* D2_in,float* D1_out,float* D2_out,
+                              int32_t width,float scale,float threshold) {
+  const __m256 zero    = _mm256_setzero_ps();
+  const __m256 invalid = _mm256_set1_ps(-10.0f);
+  const __m256 abs_msk = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+  const __m256 s       = _mm256_set1_ps(scale);
+  const __m256 thr     = _mm256_set1_ps(threshold);
+  const __m256 w       = _mm256_set1_ps((float)width);
+  __m256 u_vec = _mm256_setr_ps(0,1,2,3,4,5,6,7);
+  int32_t u = 0;
+  for (; u+8<=width; u+=8, u_vec=_mm256_add_ps(u_vec,_mm256_set1_ps(8.0f))) {
+    __m256 d1 = _mm256_loadu_ps(D1_in+u);
+    __m256 d2 = _mm256_loadu_ps(D2_in+u);
+    
+    // 投影位置及其有效性；只从有效通道收集另一幅视差图的值
+    __m256 u_warp_1 = _mm256_sub_ps(u_vec,_mm256_mul_ps(d1,s));
+    __m256 u_warp_2 = _mm256_add_ps(u_vec,_mm256_mul_ps(d2,s));
+    __m256 valid_1  = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(d1,zero,_CMP_GE_OQ),_mm256_cmp_ps(u_warp_1,zero,_CMP_GE_OQ)),
+                                    _mm256_cmp_ps(u_warp_1,w,_CMP_LT_OQ));
+    __m256 valid_2  = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(d2,zero,_CMP_GE_OQ),_mm256_cmp_ps(u_warp_2,zero,_CMP_GE_OQ)),
+                                    _mm256_cmp_ps(u_warp_2,w,_CMP_LT_OQ));
+    __m256 d2_warp  = _mm256_mask_i32gather_ps(zero,D2_in,_mm256_cvttps_epi32(u_warp_1),valid_1,4);
+    __m256 d1_warp  = _mm256_mask_i32gather_ps(zero,D1_in,_mm256_cvttps_epi32(u_warp_2),valid_2,4);
+    
+    // 一致性：|d_warp-d| <= threshold
+    __m256 ok_1 = _mm256_and_ps(valid_1,_mm256_cmp_ps(_mm256_and_ps(_mm256_sub_ps(d2_warp,d1),abs_msk),thr,_CMP_LE_OQ));
+    __m256 ok_2 = _mm256_and_ps(valid_2,_mm256_cmp_ps(_mm256_and_ps(_mm256_sub_ps(d1_warp,d2),abs_msk),thr,_CMP_LE_OQ));
+    _mm256_storeu_ps(D1_out+u,_mm256_blendv_ps(invalid,d1,ok_1));
+    _mm256_storeu_ps(D2_out+u,_mm256_blendv_ps(invalid,d2,ok_2));
+  }
+  return u;
+}
+
+int32_t simd::adaptiveMeanRowAVX2 (const float* in,float* out,int32_t width,int32_t window) {
+  
+  // 通道 r 处理位置 u0+r，其窗口从 base+r 开始（base = u0-window+1 为 8 的倍数）。
+  // 槽位 j 存放窗口中位置 % window == j 的值，即 base+j、base+j+4 或 base+j+8 中落在窗口内的一个，
+  // 因此每个槽位只需广播至多 3 个值并按通道混合
+  const __m256i lane = _mm256_setr_epi32(0,1,2,3,4,5,6,7);
+  const int32_t c    = window/2-1;
+  int32_t u = window-1;
+  for (; u+8<=width; u+=8) {
+    const float* base = in+u-window+1;
+    __m256 val[8];
+    for (int32_t j=0; j<window; j++) {
+      val[j] = _mm256_broadcast_ss(base+j);
+      for (int32_t k=j+window; k<window+7; k+=window) {
+        __m256 later = _mm256_castsi256_ps(_mm256_cmpgt_epi32(lane,_mm256_set1_epi32(k-window)));
+        val[j] = _mm256_blendv_ps(val[j],_mm256_broadcast_ss(base+k),later);
+      }
+    }
+    meanStore(val,_mm256_loadu_ps(in+u-c),window,out+u-c);
+  }
+  return u;
+}
+
+int32_t simd::adaptiveMeanColumnsAVX2 (const float* const* rows,const float* center,float* out,
+                                       int32_t u_begin,int32_t u_end,int32_t window) {
+  int32_t u = u_begin;
+  for (; u+8<=u_end; u+=8) {
+    __m256 val[8];
+    for (int32_t j=0; j<window; j++)
+      val[j] = _mm256_loadu_ps(rows[j]+u);
+    meanStore(val,_mm256_loadu_ps(center+u),window,out+u);
+  }
+  return u;
+}
+
+int32_t simd::median7AVX2 (const float* const* taps,const float* cond,float* out,int32_t u_begin,int32_t u_end) {
+  int32_t u = u_begin;
+  for (; u+8<=u_end; u+=8) {
+    __m256 val[7];
+    for (int32_t k=0; k<7; k++)
+      val[k] = _mm256_loadu_ps(taps[k]+u);
+    median7(val);
+    __m256 c     = _mm256_loadu_ps(cond+u);
+    __m256 valid = _mm256_cmp_ps(c,_mm256_setzero_ps(),_CMP_GE_OQ);
+    _mm256_storeu_ps(out+u,_mm256_blendv_ps(c,val[3],valid));
+  }
+  return u;
+}
@@ -536,7 +536,9 @@ struct memorypool {
 };
 
 
-/* Global constants.                                                         */
+/* Global constants.  They depend only on the floating-point arithmetic and  */
+/*   are computed exactly once by exactinit() (see triangleinit()); after    */
+/*   that they are only read, so concurrent triangulations may share them.   */
 
 float splitter;       /* Used to split float factors for exact multiplication. */
 float epsilon;                             /* Floating-point machine epsilon. */
@@ -545,11 +547,6 @@ float ccwerrboundA, ccwerrboundB, ccwerrboundC;
 float iccerrboundA, iccerrboundB, iccerrboundC;
 float o3derrboundA, o3derrboundB, o3derrboundC;
 
-/* Random number seed is not constant, but I've made it global anyway.       */
-
-unsigned long long randomseed;                     /* Current random number seed. */
-
-
 /* Mesh data structure.  Triangle operates on only one mesh, but the mesh    */
 /*   structure is used (instead of global variables) to allow reentrancy.    */
 
@@ -634,6 +631,11 @@ struct mesh {
 
   struct otri recenttri;
 
+/* Random number seed.  Kept per mesh (instead of globally) so that several  */
+/*   triangulations can run on different threads at the same time.          */
+
+  unsigned long long randomseed;                /* Current random number seed. */
+
 };                                                  /* End of `struct mesh'. */
 
 
@@ -4027,9 +4029,13 @@ void triangleinit(struct mesh *m)
   m->checkquality = 0;     /* The quality triangulation stage has not begun. */
   m->incirclecount = m->counterclockcount = m->orient3dcount = 0;
   m->hyperbolacount = m->circletopcount = m->circumcentercount = 0;
-  randomseed = 1;
+  m->randomseed = 1;
 
-  exactinit();                     /* Initialize exact arithmetic constants. */
+  /* Initialize exact arithmetic constants.  The thread-safe initialization  */
+  /*   of a local static guarantees that this happens only once, even if     */
+  /*   several threads call triangulate() at the same time.                  */
+  static const int exactinitialized = (exactinit(), 1);
+  (void) exactinitialized;
 }
 
 /*****************************************************************************/
@@ -4042,10 +4048,10 @@ void triangleinit(struct mesh *m)
 /*                                                                           */
 /*****************************************************************************/
 
-unsigned long long randomnation(unsigned int choices)
+unsigned long long randomnation(struct mesh *m, unsigned int choices)
 {
-  randomseed = (randomseed * 1366l + 150889l) % 714025l;
-  return randomseed / (714025l / choices + 1);
+  m->randomseed = (m->randomseed * 1366l + 150889l) % 714025l;
+  return m->randomseed / (714025l / choices + 1);
 }
 
 /********* Point location routines begin here                        *********/
@@ -4376,7 +4382,7 @@ enum locateresult locate(struct mesh *m, struct behavior *b,
     /* Choose `samplesleft' randomly sampled triangles in this block. */
     do {
       sampletri.tri = (triangle *) (firsttri +
-                                    (randomnation((unsigned int) population) *
+                                    (randomnation(m, (unsigned int) population) *
                                      m->triangles.itembytes));
       if (!deadtri(sampletri.tri)) {
         org(sampletri, torg);
@@ -5443,7 +5449,7 @@ void triangulatepolygon(struct mesh *m, struct behavior *b,
 /*                                                                           */
 /*****************************************************************************/
 
-void vertexsort(vertex *sortarray, int arraysize)
+void vertexsort(struct mesh *m, vertex *sortarray, int arraysize)
 {
   int left, right;
   int pivot;
@@ -5462,7 +5468,7 @@ void vertexsort(vertex *sortarray, int arraysize)
     return;
   }
   /* Choose a random pivot to split the array. */
-  pivot = (int) randomnation((unsigned int) arraysize);
+  pivot = (int) randomnation(m, (unsigned int) arraysize);
   pivotx = sortarray[pivot][0];
   pivoty = sortarray[pivot][1];
   /* Split the array. */
@@ -5490,11 +5496,11 @@ void vertexsort(vertex *sortarray, int arraysize)
   }
   if (left > 1) {
     /* Recursively sort the left subset. */
-    vertexsort(sortarray, left);
+    vertexsort(m, sortarray, left);
   }
   if (right < arraysize - 2) {
     /* Recursively sort the right subset. */
-    vertexsort(&sortarray[right + 1], arraysize - right - 1);
+    vertexsort(m, &sortarray[right + 1], arraysize - right - 1);
   }
 }
 
@@ -5510,7 +5516,8 @@ void vertexsort(vertex *sortarray, int arraysize)
 /*                                                                           */
 /*****************************************************************************/
 
-void vertexmedian(vertex *sortarray, int arraysize, int median, int axis)
+void vertexmedian(struct mesh *m, vertex *sortarray, int arraysize, int median,
+                  int axis)
 {
   int left, right;
   int pivot;
@@ -5529,7 +5536,7 @@ void vertexmedian(vertex *sortarray, int arraysize, int median, int axis)
     return;
   }
   /* Choose a random pivot to split the array. */
-  pivot = (int) randomnation((unsigned int) arraysize);
+  pivot = (int) randomnation(m, (unsigned int) arraysize);
   pivot1 = sortarray[pivot][axis];
   pivot2 = sortarray[pivot][1 - axis];
   /* Split the array. */
@@ -5559,11 +5566,11 @@ void vertexmedian(vertex *sortarray, int arraysize, int median, int axis)
   /*   conditionals is true.                             */
   if (left > median) {
     /* Recursively shuffle the left subset. */
-    vertexmedian(sortarray, left, median, axis);
+    vertexmedian(m, sortarray, left, median, axis);
   }
   if (right < median - 1) {
     /* Recursively shuffle the right subset. */
-    vertexmedian(&sortarray[right + 1], arraysize - right - 1,
+    vertexmedian(m, &sortarray[right + 1], arraysize - right - 1,
                  median - right - 1, axis);
   }
 }
@@ -5579,7 +5586,7 @@ void vertexmedian(vertex *sortarray, int arraysize, int median, int axis)
 /*                                                                           */
 /*****************************************************************************/
 
-void alternateaxes(vertex *sortarray, int arraysize, int axis)
+void alternateaxes(struct mesh *m, vertex *sortarray, int arraysize, int axis)
 {
   int divider;
 
@@ -5590,13 +5597,13 @@ void alternateaxes(vertex *sortarray, int arraysize, int axis)
     axis = 0;
   }
   /* Partition with a horizontal or vertical cut. */
-  vertexmedian(sortarray, arraysize, divider, axis);
+  vertexmedian(m, sortarray, arraysize, divider, axis);
   /* Recursively partition the subsets with a cross cut. */
   if (arraysize - divider >= 2) {
     if (divider >= 2) {
-      alternateaxes(sortarray, divider, 1 - axis);
+      alternateaxes(m, sortarray, divider, 1 - axis);
     }
-    alternateaxes(&sortarray[divider], arraysize - divider, 1 - axis);
+    alternateaxes(m, &sortarray[divider], arraysize - divider, 1 - axis);
   }
 }
 
@@ -6175,7 +6182,7 @@ long divconqdelaunay(struct mesh *m, struct behavior *b)
     sortarray[i] = vertextraverse(m);
   }
   /* Sort the vertices. */
-  vertexsort(sortarray, m->invertices);
+  vertexsort(m, sortarray, m->invertices);
   /* Discard duplicate vertices, which can really mess up the algorithm. */
   i = 0;
   for (j = 1; j < m->invertices; j++) {
@@ -6199,9 +6206,9 @@ long divconqdelaunay(struct mesh *m, struct behavior *b)
     divider = i >> 1;
     if (i - divider >= 2) {
       if (divider >= 2) {
-        alternateaxes(sortarray, divider, 1);
+        alternateaxes(m, sortarray, divider, 1);
       }
-      alternateaxes(&sortarray[divider], i - divider, 1);
+      alternateaxes(m, &sortarray[divider], i - divider, 1);
     }
   }
 